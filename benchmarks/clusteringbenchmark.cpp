@@ -0,0 +1,334 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Checks MarkerClusterHolder against the original per-pixel grid clustering,
+ * which is kept below as the reference implementation, and compares their
+ * speed. Random markers, half of them spread over the earth and half of them
+ * in a few dense spots, are clustered for every projection at several zoom
+ * levels. Both have to give the same clusters at the same pixels, with the
+ * same markers in the same order. The views are detailed enough that every
+ * marker is projected on its own, coarser views project the cells of the
+ * marker hierarchy instead, which only approximate the reference.
+ *
+ * The map is shown on screen, so that it has its real size. The exit code is
+ * 1 if any view gives different clusters.
+ *
+ *   clusteringbenchmark [markercount]
+ */
+
+#include "markerclusterholder.h"
+
+#include <QApplication>
+#include <QTextStream>
+#include <QTime>
+
+#include <marble/MarbleMap.h>
+
+#include <cmath>
+
+// every view is clustered for at least this long, to average out the noise
+const int MinimumRunTime = 500;
+const int DenseSpots = 5;
+const int Radii[] = { 250, 1000, 4000 };
+
+static int squareDistance(const QPoint& a, const QPoint& b)
+{
+  return (a.x()-b.x())*(a.x()-b.x()) + (a.y()-b.y())*(a.y()-b.y());
+}
+
+/*
+ * The clustering as it was before the occupied pixels were kept sparsely:
+ * one list of markers per pixel of the map, and every round rescans all
+ * occupied pixels for the fullest one which is not too close to a cluster.
+ */
+static MarkerClusterHolder::ClusterInfo::List referenceClusters(Marble::MarbleWidget* const marbleWidget,
+                                                                const MarkerClusterHolder::MarkerInfo::List& markers)
+{
+  typedef MarkerClusterHolder::QIntList QIntList;
+  MarkerClusterHolder::ClusterInfo::List clusters;
+  const int gridSize = MarkerClusterHolder::ClusterGridSizeScreen;
+  
+  // add all markers to a grid:
+  const QSize mapSize = marbleWidget->map()->size();
+  const int gridWidth = mapSize.width();
+  const int gridHeight = mapSize.height();
+  QVector<QIntList> pixelGrid(gridWidth*gridHeight, QIntList());
+  QList<QPair<QPoint, QIntList> > leftOverList;
+  for (int i = 0; i<markers.count(); ++i)
+  {
+    const MarkerClusterHolder::MarkerInfo& marker = markers.at(i);
+    
+    // get the screen coordinates and check whether the marker is on screen:
+    int markerX, markerY;
+#if MARBLE_VERSION >= 0x000800
+    qreal qrealMarkerX, qrealMarkerY;
+    if (!marbleWidget->screenCoordinates(marker.lon(), marker.lat(), qrealMarkerX, qrealMarkerY))
+      continue;
+    markerX = int(qrealMarkerX);
+    markerY = int(qrealMarkerY);
+#else
+    if (!marbleWidget->screenCoordinates(marker.lon(), marker.lat(), markerX, markerY))
+      continue;
+#endif
+
+    // make sure we are in the grid
+    markerX = qBound(0, markerX, gridWidth-1);
+    markerY = qBound(0, markerY, gridHeight-1);
+   
+    // save the position of the marker:
+    pixelGrid[markerX+markerY*gridWidth]<<i;
+  }
+  
+  QIntList pixelGridIndices;
+  for (int i=0; i<gridWidth*gridHeight; ++i)
+  {
+    if (!pixelGrid[i].isEmpty())
+      pixelGridIndices << i;
+  }
+  
+  // re-add the markers to clusters:
+  int lastTooCloseClusterIndex = 0;
+  while (true)
+  {
+    int markerMax(0), markerX(0), markerY(0), pixelGridMetaIndexMax = 0;
+    
+    for (int pixelGridMetaIndex = 0; pixelGridMetaIndex<pixelGridIndices.size(); ++pixelGridMetaIndex)
+    {
+      const int index = pixelGridIndices[pixelGridMetaIndex];
+      if (index<0)
+        continue;
+      
+      if (pixelGrid[index].isEmpty())
+      {
+        pixelGridIndices[pixelGridMetaIndex] = -1;
+        continue;
+      }
+      
+      const int x = index % gridWidth;
+      const int y = (index-x)/gridWidth;
+      const QPoint markerPosition(x, y);
+      
+      if (pixelGrid[index].size()>markerMax)
+      {
+        // only create a cluster here if it is not too close to another cluster:
+        bool tooClose = false;
+        
+        // check the cluster that was a problem last time first:
+        if (lastTooCloseClusterIndex<clusters.size())
+        {
+          tooClose = squareDistance(clusters.at(lastTooCloseClusterIndex).pixelPos, markerPosition) < pow(MarkerClusterHolder::ClusterGridSizeScreen/2, 2);
+        }
+        
+        // now check all other clusters:
+        for (int i=0; (!tooClose)&&(i<clusters.size()); ++i)
+        {
+          if (i==lastTooCloseClusterIndex)
+              continue;
+            
+          tooClose = squareDistance(clusters.at(i).pixelPos, markerPosition) < pow(MarkerClusterHolder::ClusterGridSizeScreen/2, 2);
+          if (tooClose)
+            lastTooCloseClusterIndex = i;
+        }
+          
+        if (tooClose)
+        {
+          // move markers into leftover list
+          leftOverList << QPair<QPoint, QIntList>(QPoint(x,y), pixelGrid[index]);
+          pixelGrid[index].clear();
+          pixelGridIndices[pixelGridMetaIndex] = -1;
+        }
+        else
+        {
+          markerMax=pixelGrid[x+y*gridWidth].size();
+          markerX=x;
+          markerY=y;
+          pixelGridMetaIndexMax = pixelGridMetaIndex;
+        }
+      }
+    }
+    
+    if (markerMax==0)
+      break;
+    
+    // create a cluster at this point:
+    MarkerClusterHolder::ClusterInfo cluster;
+    cluster.setCenter(markers.at(pixelGrid[markerX+markerY*gridWidth].first()));
+    cluster.pixelPos = QPoint(markerX, markerY);
+    cluster.addMarkerIndices(pixelGrid[markerX+markerY*gridWidth]);
+    pixelGrid[markerX+markerY*gridWidth].clear();
+    pixelGridIndices[pixelGridMetaIndexMax] = -1;
+    
+    // absorb all markers around it:
+    const int eatRadius = gridSize/4;
+    const int xStart = std::max( (markerX-eatRadius), 0);
+    const int yStart = std::max( (markerY-eatRadius), 0);
+    const int xEnd = std::min( (markerX+eatRadius), gridWidth-1);
+    const int yEnd = std::min( (markerY+eatRadius), gridHeight-1);
+    for (int indexX=xStart; indexX<=xEnd; ++indexX)
+    {
+      for (int indexY=yStart; indexY<=yEnd; ++indexY)
+      {
+        const int index = indexX + indexY*gridWidth;
+        cluster.addMarkerIndices(pixelGrid[index]);
+        pixelGrid[index].clear();
+      }
+    }
+    
+    clusters<<cluster;
+  }
+  
+  // now move all leftover markers into clusters:
+  for (QList<QPair<QPoint, QIntList> >::const_iterator it = leftOverList.constBegin(); it!=leftOverList.constEnd(); ++it)
+  {
+    const QPoint markerPosition = it->first;
+
+    // find the closest cluster:
+    int closestSquareDistance = 0;
+    int closestIndex = -1;
+    for (int i=0; i<clusters.size(); ++i)
+    {
+      const int distance = squareDistance(clusters.at(i).pixelPos, markerPosition);
+      if ((closestIndex<0)||(distance<closestSquareDistance))
+      {
+        closestSquareDistance = distance;
+        closestIndex = i;
+      }
+    }
+        
+    if (closestIndex>=0)
+    {
+      clusters[closestIndex].addMarkerIndices(it->second);
+    }
+  }
+  
+  return clusters;
+}
+
+static qreal randomReal(const qreal low, const qreal high)
+{
+  return low + (high-low)*qrand()/RAND_MAX;
+}
+
+static MarkerClusterHolder::MarkerInfo::List randomMarkers(const int count, QList<QPointF>* const spots)
+{
+  for (int i=0; i<DenseSpots; ++i)
+  {
+    *spots << QPointF(randomReal(-170.0, 170.0), randomReal(-60.0, 60.0));
+  }
+  
+  MarkerClusterHolder::MarkerInfo::List markers;
+  for (int i=0; i<count; ++i)
+  {
+    if (i%2)
+    {
+      markers << MarkerClusterHolder::MarkerInfo(randomReal(-180.0, 180.0), randomReal(-85.0, 85.0), i);
+      continue;
+    }
+    
+    const QPointF& spot = spots->at(i/2%DenseSpots);
+    markers << MarkerClusterHolder::MarkerInfo(spot.x()+randomReal(-0.5, 0.5), spot.y()+randomReal(-0.5, 0.5), i);
+  }
+  return markers;
+}
+
+// returns an empty string if the clusters are the same, otherwise the first difference
+static QString compareClusters(const MarkerClusterHolder::ClusterInfo::List& clusters,
+                               const MarkerClusterHolder::ClusterInfo::List& reference)
+{
+  if (clusters.count()!=reference.count())
+    return QString("%1 clusters instead of %2").arg(clusters.count()).arg(reference.count());
+  
+  for (int i=0; i<clusters.count(); ++i)
+  {
+    const MarkerClusterHolder::ClusterInfo& cluster = clusters.at(i);
+    const MarkerClusterHolder::ClusterInfo& expected = reference.at(i);
+    if (cluster.pixelPos!=expected.pixelPos)
+      return QString("cluster %1 at %2,%3 instead of %4,%5").arg(i).arg(cluster.pixelPos.x()).arg(cluster.pixelPos.y())
+                                                          .arg(expected.pixelPos.x()).arg(expected.pixelPos.y());
+    if (cluster.markerIndices!=expected.markerIndices)
+      return QString("cluster %1 has other markers, %2 instead of %3").arg(i).arg(cluster.markerCount()).arg(expected.markerCount());
+  }
+  return QString();
+}
+
+int main(int argc, char *argv[])
+{
+  QApplication app(argc, argv);
+  QTextStream out(stdout);
+  const int markerCount = (argc>1) ? QString(argv[1]).toInt() : 20000;
+  
+  Marble::MarbleWidget marbleWidget;
+  marbleWidget.resize(1920, 1080);
+  marbleWidget.show();
+  app.processEvents();
+  
+  qsrand(1);
+  QList<QPointF> spots;
+  const MarkerClusterHolder::MarkerInfo::List markers = randomMarkers(markerCount, &spots);
+  MarkerClusterHolder holder(&marbleWidget);
+  holder.setMarkers(markers);
+  
+  QList<QPair<Marble::Projection, QString> > projections;
+  projections << qMakePair(Marble::Spherical, QString("spherical"));
+  projections << qMakePair(Marble::Equirectangular, QString("equirectangular"));
+#if MARBLE_VERSION >= 0x000800
+  projections << qMakePair(Marble::Mercator, QString("mercator"));
+#endif // MARBLE_VERSION >= 0x000800
+  
+  const QSize mapSize = marbleWidget.map()->size();
+  out << markerCount << " markers on a " << mapSize.width() << "x" << mapSize.height() << " map" << endl;
+  bool allSame = true;
+  for (QList<QPair<Marble::Projection, QString> >::const_iterator projection = projections.constBegin(); projection!=projections.constEnd(); ++projection)
+  {
+    marbleWidget.setProjection(projection->first);
+    for (unsigned int radius=0; radius<sizeof(Radii)/sizeof(Radii[0]); ++radius)
+    {
+      marbleWidget.setRadius(Radii[radius]);
+      const QPointF& spot = spots.at(radius%DenseSpots);
+      
+      // the clusters are only reordered when the map moves, so the view is panned back and forth by a bit:
+      double times[2];
+      for (int implementation=0; implementation<2; ++implementation)
+      {
+        QTime timer;
+        timer.start();
+        int runs = 0;
+        do
+        {
+          marbleWidget.centerOn(spot.x()+(runs%2)*0.001, spot.y());
+          if (implementation==0)
+            holder.reorderClusters();
+          else
+            referenceClusters(&marbleWidget, markers);
+          ++runs;
+        } while ((timer.elapsed()<MinimumRunTime)||(runs%2));
+        times[implementation] = double(timer.elapsed())/runs;
+      }
+      
+      const QString difference = compareClusters(holder.clusters(), referenceClusters(&marbleWidget, markers));
+      allSame = allSame && difference.isEmpty();
+      out << "  " << qSetFieldWidth(16) << left << projection->second << qSetFieldWidth(0)
+          << "radius " << qSetFieldWidth(5) << right << Radii[radius] << qSetFieldWidth(0) << ": "
+          << qSetRealNumberPrecision(2) << fixed << times[0] << " ms, reference " << times[1] << " ms, "
+          << holder.clusters().count() << " clusters, "
+          << (difference.isEmpty() ? QString("same clusters") : difference) << endl;
+    }
+  }
+  
+  return allSame ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compares ExifScanner::scanFile() with opening the file with Exiv2 and
+ * reading all of its metadata, which is what Photo::Photo did before. All
+ * JPEG files in the given directory are read by both, and the files per
+ * second and the number of files with a GPS position and a timestamp are
+ * printed for each. The files are read once before the measurement, so that
+ * both work on the page cache.
+ *
+ *   exifscannerbenchmark directory
+ */
+
+#include "exifscanner.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
+#include <QTime>
+
+#include <exiv2/image.hpp>
+#include <exiv2/exif.hpp>
+
+// every variant is run for at least this long, to average out the noise
+const int MinimumRunTime = 500;
+
+enum Variant
+{
+  Scanner,
+  Exiv2Metadata,
+  VariantCount
+};
+
+static bool hasGeotag(const Variant variant, const QString &filename)
+{
+  if (variant == Scanner)
+  {
+    ExifScanner scanner;
+    const ExifScanner::Result result = scanner.scanFile(filename);
+    return (result == ExifScanner::Ok) && scanner.hasGpsPosition() && scanner.hasDateTimeOriginal();
+  }
+
+  try
+  {
+    Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(QFile::encodeName(filename).constData());
+    image->readMetadata();
+    Exiv2::ExifData &exifData = image->exifData();
+    return (exifData.findKey(Exiv2::ExifKey("Exif.GPSInfo.GPSLatitude")) != exifData.end()) &&
+           (exifData.findKey(Exiv2::ExifKey("Exif.GPSInfo.GPSLongitude")) != exifData.end()) &&
+           (exifData.findKey(Exiv2::ExifKey("Exif.Photo.DateTimeOriginal")) != exifData.end());
+  }
+  catch (const Exiv2::AnyError&)
+  {
+    return false;
+  }
+}
+
+// returns the files per second, geotagged is set to the number of geotagged files
+static double timeReading(const Variant variant, const QStringList &filenames, int *geotagged)
+{
+  QTime timer;
+  timer.start();
+  int files = 0;
+  do
+  {
+    *geotagged = 0;
+    for (QStringList::const_iterator it = filenames.constBegin(); it!=filenames.constEnd(); ++it)
+    {
+      if (hasGeotag(variant, *it))
+        ++*geotagged;
+    }
+    files += filenames.count();
+  } while (timer.elapsed() < MinimumRunTime);
+
+  return 1000.0 * files / qMax(1, timer.elapsed());
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QTextStream out(stdout);
+  const char * const variantNames[VariantCount] = { "ExifScanner", "Exiv2" };
+
+  if (app.arguments().count() != 2)
+  {
+    out << "usage: exifscannerbenchmark directory" << endl;
+    return 1;
+  }
+
+  const QDir directory(app.arguments().at(1));
+  QStringList filenames;
+  const QStringList entries = directory.entryList(QStringList() << "*.jpg" << "*.jpeg" << "*.JPG" << "*.JPEG", QDir::Files);
+  for (QStringList::const_iterator it = entries.constBegin(); it!=entries.constEnd(); ++it)
+    filenames << directory.filePath(*it);
+
+  if (filenames.isEmpty())
+  {
+    out << "no JPEG files in " << directory.path() << endl;
+    return 1;
+  }
+
+  // bring the files into the page cache:
+  for (QStringList::const_iterator it = filenames.constBegin(); it!=filenames.constEnd(); ++it)
+  {
+    QFile file(*it);
+    if (file.open(QIODevice::ReadOnly))
+      file.readAll();
+  }
+
+  out << filenames.count() << " files in " << directory.path() << endl;
+  for (int variant=0; variant<VariantCount; ++variant)
+  {
+    int geotagged = 0;
+    const double filesPerSecond = timeReading(Variant(variant), filenames, &geotagged);
+    out << "  " << qSetFieldWidth(14) << left << variantNames[variant] << qSetFieldWidth(0)
+        << qSetRealNumberPrecision(1) << fixed << filesPerSecond << " files/s  "
+        << geotagged << " geotagged" << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Compares ImageScaler with QImage::scaled(Qt::SmoothTransformation) for the
+ * sizes of the thumbnail levels. For every image and size the time per call
+ * and the PSNR against an exact area average in double precision are
+ * printed. The images are given on the command line, without arguments a
+ * synthetic photo sized image with fine detail is used.
+ *
+ *   imagescalerbenchmark [image...]
+ */
+
+#include "imagescaler.h"
+
+#include <QCoreApplication>
+#include <QImage>
+#include <QStringList>
+#include <QTextStream>
+#include <QTime>
+#include <QVector>
+
+#include <cmath>
+
+// every variant is run for at least this long, to average out the noise
+const int MinimumRunTime = 500;
+const int ThumbnailEdges[] = { 280, 160, 64 };
+
+// smooth gradients with a zone plate on top, which aliases if the filter is too weak
+static QImage syntheticImage(const QSize &size)
+{
+  QImage image(size, QImage::Format_RGB32);
+  const double centerX = size.width() / 2.0;
+  const double centerY = size.height() / 2.0;
+  const double frequency = 3.14159265358979323846 / size.width();
+  for (int y=0; y<size.height(); ++y)
+  {
+    QRgb *pixel = reinterpret_cast<QRgb*>(image.scanLine(y));
+    for (int x=0; x<size.width(); ++x, ++pixel)
+    {
+      const double dx = x - centerX;
+      const double dy = y - centerY;
+      const int ring = int(127.5 + 127.5 * cos(frequency * (dx * dx + dy * dy) / 4.0));
+      *pixel = qRgb(255 * x / size.width(), ring, 255 * y / size.height());
+    }
+  }
+  return image;
+}
+
+// the exact average of the source pixels covered by every output pixel
+static QImage referenceScaled(const QImage &image, const QSize &size)
+{
+  const QImage source = image.convertToFormat(QImage::Format_RGB32);
+  const double scaleX = double(source.width()) / size.width();
+  const double scaleY = double(source.height()) / size.height();
+
+  QImage result(size, QImage::Format_RGB32);
+  for (int y=0; y<size.height(); ++y)
+  {
+    const double top = y * scaleY;
+    const double bottom = (y + 1) * scaleY;
+    QRgb *out = reinterpret_cast<QRgb*>(result.scanLine(y));
+    for (int x=0; x<size.width(); ++x)
+    {
+      const double left = x * scaleX;
+      const double right = (x + 1) * scaleX;
+      double sum[3] = { 0.0, 0.0, 0.0 };
+      double area = 0.0;
+      for (int sy=int(top); (sy<source.height()) && (sy<bottom); ++sy)
+      {
+        const double height = qMin(sy + 1.0, bottom) - qMax(double(sy), top);
+        const QRgb *in = reinterpret_cast<const QRgb*>(source.constScanLine(sy));
+        for (int sx=int(left); (sx<source.width()) && (sx<right); ++sx)
+        {
+          const double weight = height * (qMin(sx + 1.0, right) - qMax(double(sx), left));
+          sum[0] += weight * qRed(in[sx]);
+          sum[1] += weight * qGreen(in[sx]);
+          sum[2] += weight * qBlue(in[sx]);
+          area += weight;
+        }
+      }
+      out[x] = qRgb(qRound(sum[0] / area), qRound(sum[1] / area), qRound(sum[2] / area));
+    }
+  }
+  return result;
+}
+
+static double psnr(const QImage &image, const QImage &reference)
+{
+  if (image.size() != reference.size())
+    return 0.0;
+
+  const QImage a = image.convertToFormat(QImage::Format_RGB32);
+  double squaredError = 0.0;
+  for (int y=0; y<a.height(); ++y)
+  {
+    const QRgb *pixel = reinterpret_cast<const QRgb*>(a.constScanLine(y));
+    const QRgb *expected = reinterpret_cast<const QRgb*>(reference.constScanLine(y));
+    for (int x=0; x<a.width(); ++x)
+    {
+      const int red = qRed(pixel[x]) - qRed(expected[x]);
+      const int green = qGreen(pixel[x]) - qGreen(expected[x]);
+      const int blue = qBlue(pixel[x]) - qBlue(expected[x]);
+      squaredError += red * red + green * green + blue * blue;
+    }
+  }
+
+  const double meanSquaredError = squaredError / (3.0 * a.width() * a.height());
+  if (meanSquaredError == 0.0)
+    return 99.0;
+
+  return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
+
+enum Variant
+{
+  QImageSmooth,
+  ScalerArea,
+  ScalerLanczos,
+  VariantCount
+};
+
+static QImage scaledWith(const Variant variant, const QImage &image, const QSize &size)
+{
+  switch (variant)
+  {
+    case QImageSmooth:
+      return image.scaled(size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    case ScalerArea:
+      return ImageScaler::scaled(image, size, ImageScaler::AreaFilter);
+    default:
+      return ImageScaler::scaled(image, size, ImageScaler::LanczosFilter);
+  }
+}
+
+// returns the milliseconds per call
+static double timeScaling(const Variant variant, const QImage &image, const QSize &size)
+{
+  QTime timer;
+  timer.start();
+  int runs = 0;
+  do
+  {
+    scaledWith(variant, image, size);
+    ++runs;
+  } while (timer.elapsed() < MinimumRunTime);
+
+  return double(timer.elapsed()) / runs;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QTextStream out(stdout);
+  const char * const variantNames[VariantCount] = { "QImage smooth", "ImageScaler area", "ImageScaler lanczos" };
+
+  QStringList filenames = app.arguments().mid(1);
+  if (filenames.isEmpty())
+    filenames << QString();
+
+  for (QStringList::const_iterator it = filenames.constBegin(); it!=filenames.constEnd(); ++it)
+  {
+    const QImage loaded = it->isEmpty() ? syntheticImage(QSize(4000, 3000)) : QImage(*it);
+    if (loaded.isNull())
+    {
+      out << "could not load " << *it << endl;
+      continue;
+    }
+
+    // both scalers work on 32 bit pixels, converting is not part of the measurement:
+    const QImage image = loaded.convertToFormat(QImage::Format_RGB32);
+    out << (it->isEmpty() ? QString::fromLatin1("synthetic") : *it)
+        << " (" << image.width() << "x" << image.height() << ")" << endl;
+
+    for (unsigned int edge=0; edge<sizeof(ThumbnailEdges)/sizeof(ThumbnailEdges[0]); ++edge)
+    {
+      const QSize size = image.size().scaled(QSize(ThumbnailEdges[edge], ThumbnailEdges[edge]), Qt::KeepAspectRatio);
+      const QImage reference = referenceScaled(image, size);
+      out << "  " << size.width() << "x" << size.height() << endl;
+      for (int variant=0; variant<VariantCount; ++variant)
+      {
+        const QImage scaled = scaledWith(Variant(variant), image, size);
+        const double milliseconds = timeScaling(Variant(variant), image, size);
+        out << "    " << qSetFieldWidth(20) << left << variantNames[variant] << qSetFieldWidth(0)
+            << qSetRealNumberPrecision(3) << fixed << milliseconds << " ms  "
+            << qSetRealNumberPrecision(2) << psnr(scaled, reference) << " dB" << endl;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,472 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "exifscanner.h"
+#include "photofile.h"
+
+#include <QFile>
+#include <QByteArray>
+#include <QtEndian>
+
+// the EXIF segment is almost always within the first 64 KB of the file:
+const qint64 ExifScannerInitialRead = 64 * 1024;
+// give up on files which need more than this, Exiv2 can handle them:
+const qint64 ExifScannerMaximumRead = 1024 * 1024;
+
+// TIFF field types used below
+const quint16 TiffTypeAscii = 2;
+const quint16 TiffTypeShort = 3;
+const quint16 TiffTypeLong = 4;
+const quint16 TiffTypeRational = 5;
+const quint16 TiffTypeUndefined = 7;
+
+// IFDs we are interested in
+enum ExifIfd
+{
+  Ifd0,
+  Ifd1,
+  ExifSubIfd,
+  GpsIfd
+};
+
+ExifScanner::ExifScanner()
+  : m_bigEndian(false), m_requiredSize(0), m_gpsTags(0), m_hasDateTimeOriginal(false),
+    m_gpsLat(0), m_gpsLong(0), m_gpsLatRef(0), m_gpsLongRef(0), m_dateTimeOriginal(),
+    m_tiffOffset(0), m_thumbnailOffset(0), m_thumbnailLength(0), m_previews(), m_imageSize()
+{
+}
+
+ExifScanner::Result ExifScanner::scanFile(const QString &path, const int options)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return Unsupported;
+
+  QByteArray header = file.read(ExifScannerInitialRead);
+  Result result = scan(reinterpret_cast<const uchar*>(header.constData()), header.size(), options);
+
+  // the segments did not fit into the first block, read the rest of them:
+  while ((result == Truncated) && (m_requiredSize <= ExifScannerMaximumRead))
+  {
+    const QByteArray more = file.read(m_requiredSize - header.size());
+    if (more.isEmpty())
+      break;
+
+    header += more;
+    result = scan(reinterpret_cast<const uchar*>(header.constData()), header.size(), options);
+  }
+
+  IoStatistics::addBytes(IoStatistics::MetadataStage, header.size());
+
+  return (result == Truncated) ? Unsupported : result;
+}
+
+// how much of a file to read before scanning it, scan() tells if it needs more
+qint64 ExifScanner::initialReadSize()
+{
+  return ExifScannerInitialRead;
+}
+
+// files which need more than this are better left to Exiv2
+qint64 ExifScanner::maximumReadSize()
+{
+  return ExifScannerMaximumRead;
+}
+
+/*
+ * Walks the JPEG markers up to the first APP1 segment containing EXIF data.
+ * With ScanPreviews the walk continues up to the frame header to pick up
+ * the MPF segment and the image size, with ScanImageSize it goes straight
+ * to the frame header.
+ * data has to point to the start of the file.
+ */
+ExifScanner::Result ExifScanner::scan(const uchar *data, qint64 size, const int options)
+{
+  m_gpsTags = 0;
+  m_hasDateTimeOriginal = false;
+  m_requiredSize = 0;
+  m_thumbnailOffset = 0;
+  m_thumbnailLength = 0;
+  m_previews.clear();
+  m_imageSize = QSize();
+
+  if ((size < 4) || (data[0] != 0xFF) || (data[1] != 0xD8))
+    return Unsupported;
+
+  Result exifResult = NoExif;
+  qint64 pos = 2;
+  while (true)
+  {
+    if (pos + 4 > size)
+    {
+      m_requiredSize = pos + 4;
+      return Truncated;
+    }
+
+    if (data[pos] != 0xFF)
+      return Unsupported;
+
+    const uchar marker = data[pos + 1];
+
+    // fill bytes:
+    if (marker == 0xFF)
+    {
+      ++pos;
+      continue;
+    }
+
+    // markers without a length:
+    if ((marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7)))
+    {
+      pos += 2;
+      continue;
+    }
+
+    // start of scan or end of image, there will be no EXIF data after this:
+    if ((marker == 0xDA) || (marker == 0xD9))
+      return exifResult;
+
+    const quint16 length = qFromBigEndian<quint16>(data + pos + 2);
+    if (length < 2)
+      return Unsupported;
+
+    const qint64 segmentEnd = pos + 2 + length;
+
+    // start of frame, contains the size of the main image:
+    if ((marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC))
+    {
+      if (pos + 9 > size)
+      {
+        m_requiredSize = pos + 9;
+        return Truncated;
+      }
+
+      m_imageSize = QSize(qFromBigEndian<quint16>(data + pos + 7), qFromBigEndian<quint16>(data + pos + 5));
+      return exifResult;
+    }
+
+    if (((marker == 0xE1) || (marker == 0xE2)) && (length >= 8))
+    {
+      if (pos + 10 > size)
+      {
+        m_requiredSize = pos + 10;
+        return Truncated;
+      }
+
+      const char * const identifier = reinterpret_cast<const char*>(data + pos + 4);
+      const bool isExif = (marker == 0xE1) && !(options & ScanImageSize) && (exifResult == NoExif) && (qstrncmp(identifier, "Exif", 5) == 0) && (data[pos + 9] == 0);
+      const bool isMpf = (marker == 0xE2) && (options & ScanPreviews) && !(options & ScanImageSize) && (qstrncmp(identifier, "MPF", 4) == 0);
+
+      if ((isExif || isMpf) && (segmentEnd > size))
+      {
+        m_requiredSize = segmentEnd;
+        return Truncated;
+      }
+
+      if (isExif)
+      {
+        exifResult = scanTiff(data + pos + 10, length - 8, pos + 10);
+        if ((exifResult != Ok) || !(options & ScanPreviews))
+          return exifResult;
+      }
+      else if (isMpf)
+      {
+        // broken MPF data only means that there are no previews:
+        scanMpf(data + pos + 8, length - 6, pos + 8);
+      }
+    }
+
+    pos = segmentEnd;
+  }
+}
+
+ExifScanner::Result ExifScanner::scanTiff(const uchar *tiff, quint32 size, qint64 tiffOffset)
+{
+  m_tiffOffset = tiffOffset;
+
+  if (size < 8)
+    return Unsupported;
+
+  if ((tiff[0] == 'I') && (tiff[1] == 'I'))
+    m_bigEndian = false;
+  else if ((tiff[0] == 'M') && (tiff[1] == 'M'))
+    m_bigEndian = true;
+  else
+    return Unsupported;
+
+  if (get16(tiff + 2) != 42)
+    return Unsupported;
+
+  if (!readIfd(tiff, size, get32(tiff + 4), Ifd0))
+    return Unsupported;
+
+  if ((m_thumbnailOffset > 0) && (m_thumbnailLength > 0))
+  {
+    Preview thumbnail;
+    thumbnail.offset = m_thumbnailOffset;
+    thumbnail.length = m_thumbnailLength;
+    m_previews << thumbnail;
+  }
+
+  if (m_gpsTags & GpsLatRefTag)
+  {
+    if ((m_gpsLatRef == 'S') || (m_gpsLatRef == 'W'))
+      m_gpsLat *= -1;
+  }
+
+  if (m_gpsTags & GpsLongRefTag)
+  {
+    if ((m_gpsLongRef == 'S') || (m_gpsLongRef == 'W'))
+      m_gpsLong *= -1;
+  }
+
+  return Ok;
+}
+
+bool ExifScanner::readIfd(const uchar *tiff, quint32 size, quint32 offset, int ifd)
+{
+  if ((offset < 8) || (offset > size - 2))
+    return false;
+
+  const quint32 entryCount = get16(tiff + offset);
+  if (entryCount * 12 > size - offset - 2)
+    return false;
+
+  // IFD1 follows IFD0 and describes the embedded thumbnail:
+  if ((ifd == Ifd0) && (entryCount * 12 + 4 <= size - offset - 2))
+  {
+    const quint32 nextIfd = get32(tiff + offset + 2 + entryCount * 12);
+    if (nextIfd != 0)
+    {
+      // a broken thumbnail is no reason to reject the metadata:
+      readIfd(tiff, size, nextIfd, Ifd1);
+    }
+  }
+
+  for (quint32 i = 0; i < entryCount; ++i)
+  {
+    const uchar * const entry = tiff + offset + 2 + i * 12;
+    const quint16 tag = get16(entry);
+    const quint16 type = get16(entry + 2);
+    const quint32 count = get32(entry + 4);
+    const quint32 value = get32(entry + 8);
+
+    switch (ifd)
+    {
+      case Ifd0:
+        // pointers to the Exif and GPS IFDs:
+        if (((tag == 0x8769) || (tag == 0x8825)) && (type == TiffTypeLong))
+        {
+          if (!readIfd(tiff, size, value, (tag == 0x8769) ? ExifSubIfd : GpsIfd))
+            return false;
+        }
+        break;
+
+      case Ifd1:
+        // JPEGInterchangeFormat and JPEGInterchangeFormatLength
+        if (((tag == 0x0201) || (tag == 0x0202)) && ((type == TiffTypeLong) || (type == TiffTypeShort)) && (count == 1))
+        {
+          const quint32 number = (type == TiffTypeShort) ? get16(entry + 8) : value;
+          if (tag == 0x0201)
+            m_thumbnailOffset = m_tiffOffset + number;
+          else
+            m_thumbnailLength = number;
+        }
+        break;
+
+      case ExifSubIfd:
+        // DateTimeOriginal, "YYYY:MM:DD HH:MM:SS"
+        if ((tag == 0x9003) && (type == TiffTypeAscii))
+        {
+          if ((count <= 4) || (value > size) || (count > size - value))
+            return false;
+
+          m_dateTimeOriginal = parseDateTime(reinterpret_cast<const char*>(tiff + value), count);
+          m_hasDateTimeOriginal = true;
+        }
+        break;
+
+      case GpsIfd:
+        if (((tag == 1) || (tag == 3)) && (type == TiffTypeAscii))
+        {
+          // the reference is a single character, stored inside the entry:
+          if (count > 4)
+            return false;
+
+          if (tag == 1)
+          {
+            m_gpsLatRef = count ? entry[8] : 0;
+            m_gpsTags |= GpsLatRefTag;
+          }
+          else
+          {
+            m_gpsLongRef = count ? entry[8] : 0;
+            m_gpsTags |= GpsLongRefTag;
+          }
+        }
+        else if ((tag == 2) || (tag == 4))
+        {
+          if (type != TiffTypeRational)
+            return false;
+
+          if (tag == 2)
+          {
+            if (!readRational(tiff, size, value, count, &m_gpsLat))
+              return false;
+            m_gpsTags |= GpsLatTag;
+          }
+          else
+          {
+            if (!readRational(tiff, size, value, count, &m_gpsLong))
+              return false;
+            m_gpsTags |= GpsLongTag;
+          }
+        }
+        break;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Collects the images listed in the MP Index IFD of an APP2 "MPF" segment.
+ * The first entry is the main image itself and is skipped.
+ */
+bool ExifScanner::scanMpf(const uchar *mpf, quint32 size, qint64 mpfOffset)
+{
+  if (size < 8)
+    return false;
+
+  const bool exifBigEndian = m_bigEndian;
+  if ((mpf[0] == 'I') && (mpf[1] == 'I'))
+    m_bigEndian = false;
+  else if ((mpf[0] == 'M') && (mpf[1] == 'M'))
+    m_bigEndian = true;
+  else
+    return false;
+
+  bool success = false;
+  const quint32 offset = get32(mpf + 4);
+  if ((get16(mpf + 2) == 42) && (offset >= 8) && (offset <= size - 2))
+  {
+    const quint32 entryCount = get16(mpf + offset);
+    success = (entryCount * 12 <= size - offset - 2);
+    for (quint32 i = 0; success && (i < entryCount); ++i)
+    {
+      const uchar * const entry = mpf + offset + 2 + i * 12;
+      const quint32 count = get32(entry + 4);
+      const quint32 value = get32(entry + 8);
+
+      // MPEntry, 16 bytes per image:
+      if ((get16(entry) != 0xB002) || (get16(entry + 2) != TiffTypeUndefined))
+        continue;
+
+      if ((value > size) || (count > size - value))
+        break;
+
+      for (quint32 image = 1; image < count / 16; ++image)
+      {
+        const uchar * const mpEntry = mpf + value + image * 16;
+        Preview preview;
+        preview.length = get32(mpEntry + 4);
+        preview.offset = mpfOffset + get32(mpEntry + 8);
+        if ((preview.length > 0) && (preview.offset > mpfOffset))
+          m_previews << preview;
+      }
+    }
+  }
+
+  m_bigEndian = exifBigEndian;
+  return success;
+}
+
+/*
+ * Reads up to three rationals (degrees, minutes, seconds) and combines them into
+ * a single value: degrees + minutes/60 + seconds/3600
+ */
+bool ExifScanner::readRational(const uchar *tiff, quint32 size, quint32 offset, quint32 count, qreal *value) const
+{
+  if ((count == 0) || (offset > size) || (count > (size - offset) / 8))
+    return false;
+
+  qreal total = 0;
+  qreal divisor = 1;
+  for (quint32 i = 0; (i < count) && (i < 3); ++i)
+  {
+    const quint32 numerator = get32(tiff + offset + i * 8);
+    const quint32 denominator = get32(tiff + offset + i * 8 + 4);
+    if (denominator == 0)
+      return false;
+
+    total += qreal(numerator) / qreal(denominator) / divisor;
+    divisor *= 60;
+  }
+
+  *value = total;
+  return true;
+}
+
+/*
+ * Parses the fixed-format EXIF timestamp "YYYY:MM:DD HH:MM:SS". Returns an
+ * invalid QDateTime if the text does not match, like QDateTime::fromString.
+ */
+QDateTime ExifScanner::parseDateTime(const char *text, int length)
+{
+  // the terminating zero is part of the EXIF value:
+  while ((length > 0) && (text[length - 1] == 0))
+    --length;
+
+  if (length != 19)
+    return QDateTime();
+
+  static const char pattern[] = "dddd:dd:dd dd:dd:dd";
+  int fields[6] = { 0, 0, 0, 0, 0, 0 };
+  int field = 0;
+  for (int i = 0; i < 19; ++i)
+  {
+    if (pattern[i] == 'd')
+    {
+      if ((text[i] < '0') || (text[i] > '9'))
+        return QDateTime();
+      fields[field] = fields[field] * 10 + (text[i] - '0');
+    }
+    else
+    {
+      if (text[i] != pattern[i])
+        return QDateTime();
+      ++field;
+    }
+  }
+
+  const QDate date(fields[0], fields[1], fields[2]);
+  const QTime time(fields[3], fields[4], fields[5]);
+  if (!date.isValid() || !time.isValid())
+    return QDateTime();
+
+  return QDateTime(date, time);
+}
+
+quint16 ExifScanner::get16(const uchar *p) const
+{
+  return m_bigEndian ? qFromBigEndian<quint16>(p) : qFromLittleEndian<quint16>(p);
+}
+
+quint32 ExifScanner::get32(const uchar *p) const
+{
+  return m_bigEndian ? qFromBigEndian<quint32>(p) : qFromLittleEndian<quint32>(p);
+}
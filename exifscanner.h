@@ -0,0 +1,116 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EXIFSCANNER_H
+#define EXIFSCANNER_H
+
+#include <QtGlobal>
+#include <QDateTime>
+#include <QString>
+#include <QList>
+#include <QSize>
+
+/**
+ * Fast reader for the few EXIF tags Trippy needs.
+ *
+ * Only the APP1 segment at the start of a JPEG file is looked at. IFD0, the
+ * Exif IFD and the GPS IFD are walked once and the values are decoded directly
+ * into numbers. Everything the scanner does not understand is reported as
+ * Unsupported, in which case the caller should fall back to Exiv2.
+ *
+ * With ScanPreviews the scanner also collects the embedded EXIF thumbnail,
+ * the MPF preview images and the size of the main image. ScanImageSize only
+ * looks for the size of the image, which is used to check embedded previews
+ * without reading them in full.
+ */
+class ExifScanner
+{
+  public:
+    enum Result
+    {
+      Ok,          // EXIF data was found and parsed
+      NoExif,      // valid JPEG without EXIF data
+      Truncated,   // more data is needed, see requiredSize()
+      Unsupported  // not understood, use Exiv2 instead
+    };
+
+    enum ScanOption
+    {
+      ScanMetadata = 0,
+      ScanPreviews = 1,
+      ScanImageSize = 2   // only the frame header, the EXIF and MPF segments are skipped
+    };
+
+    // an embedded JPEG image, offset is relative to the start of the file
+    struct Preview
+    {
+      qint64 offset;
+      quint32 length;
+    };
+
+    ExifScanner();
+
+    Result scanFile(const QString &path, const int options = ScanMetadata);
+    Result scan(const uchar *data, qint64 size, const int options = ScanMetadata);
+
+    inline qint64 requiredSize() const { return m_requiredSize; }
+    inline bool hasGpsPosition() const { return m_gpsTags == GpsAllTags; }
+    inline qreal getGpsLat() const { return m_gpsLat; }
+    inline qreal getGpsLong() const { return m_gpsLong; }
+    inline bool hasDateTimeOriginal() const { return m_hasDateTimeOriginal; }
+    inline QDateTime getDateTimeOriginal() const { return m_dateTimeOriginal; }
+    inline QList<Preview> getPreviews() const { return m_previews; }
+    inline QSize getImageSize() const { return m_imageSize; }
+
+    static QDateTime parseDateTime(const char *text, int length);
+    static qint64 initialReadSize();
+    static qint64 maximumReadSize();
+
+  private:
+    enum GpsTag
+    {
+      GpsLatRefTag = 1,
+      GpsLatTag = 2,
+      GpsLongRefTag = 4,
+      GpsLongTag = 8,
+      GpsAllTags = 15
+    };
+
+    Result scanTiff(const uchar *tiff, quint32 size, qint64 tiffOffset);
+    bool scanMpf(const uchar *mpf, quint32 size, qint64 mpfOffset);
+    bool readIfd(const uchar *tiff, quint32 size, quint32 offset, int ifd);
+    bool readRational(const uchar *tiff, quint32 size, quint32 offset, quint32 count, qreal *value) const;
+    quint16 get16(const uchar *p) const;
+    quint32 get32(const uchar *p) const;
+
+    bool m_bigEndian;
+    qint64 m_requiredSize;
+    int m_gpsTags;
+    bool m_hasDateTimeOriginal;
+    qreal m_gpsLat;
+    qreal m_gpsLong;
+    char m_gpsLatRef;
+    char m_gpsLongRef;
+    QDateTime m_dateTimeOriginal;
+    qint64 m_tiffOffset;
+    qint64 m_thumbnailOffset;
+    quint32 m_thumbnailLength;
+    QList<Preview> m_previews;
+    QSize m_imageSize;
+};
+
+#endif
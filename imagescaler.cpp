@@ -0,0 +1,404 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "imagescaler.h"
+
+#include <QVector>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define IMAGESCALER_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is only used if the CPU has it, which needs per-function target attributes:
+#if defined(IMAGESCALER_SSE2) && defined(__GNUC__) && \
+    (defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define IMAGESCALER_AVX2
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IMAGESCALER_NEON
+#include <arm_neon.h>
+#endif
+
+const double LanczosLobes = 3.0;
+// Lanczos shrinks beyond this factor go through the area filter first
+const int LanczosPrescaleFactor = 3;
+const double Pi = 3.14159265358979323846;
+
+// the weights of the source pixels for every output pixel along one axis
+struct FilterTaps
+{
+  FilterTaps()
+    : first(), count(), weights(), maxTaps(0)
+  {
+  }
+
+  QVector<int> first;
+  QVector<int> count;
+  QVector<float> weights; // maxTaps entries per output pixel
+  int maxTaps;
+};
+
+static double lanczos(const double x)
+{
+  if (x == 0.0)
+    return 1.0;
+  if ((x <= -LanczosLobes) || (x >= LanczosLobes))
+    return 0.0;
+
+  const double piX = Pi * x;
+  return LanczosLobes * sin(piX) * sin(piX / LanczosLobes) / (piX * piX);
+}
+
+static FilterTaps computeTaps(const int sourceSize, const int destinationSize, const ImageScaler::Filter filter)
+{
+  const double scale = double(destinationSize) / sourceSize;
+  // when shrinking, the filter is stretched to cover all source pixels:
+  const double filterScale = qMin(scale, 1.0);
+  const double halfWidth = 0.5 / filterScale;
+  const double support = (filter == ImageScaler::AreaFilter) ? halfWidth : LanczosLobes / filterScale;
+
+  FilterTaps taps;
+  taps.maxTaps = int(ceil(2.0 * support)) + 3;
+  taps.first.resize(destinationSize);
+  taps.count.resize(destinationSize);
+  taps.weights.fill(0.0f, destinationSize * taps.maxTaps);
+
+  QVector<double> weights(taps.maxTaps);
+  for (int i=0; i<destinationSize; ++i)
+  {
+    const double center = (i + 0.5) / scale;
+    int left = qMax(int(floor(center - support)), 0);
+    const int right = qMin(int(ceil(center + support)), sourceSize - 1);
+
+    double sum = 0;
+    int count = 0;
+    for (int j=left; j<=right; ++j)
+    {
+      double weight;
+      if (filter == ImageScaler::AreaFilter)
+      {
+        // the part of the source pixel which is covered by the output pixel:
+        weight = qMax(qMin(j + 1.0, center + halfWidth) - qMax(double(j), center - halfWidth), 0.0);
+      }
+      else
+      {
+        weight = lanczos((j + 0.5 - center) * filterScale);
+      }
+
+      // leading zero weights are skipped:
+      if ((count == 0) && (weight == 0.0))
+      {
+        ++left;
+        continue;
+      }
+
+      weights[count++] = weight;
+      sum += weight;
+    }
+
+    // drop trailing zero weights:
+    while ((count > 1) && (weights[count - 1] == 0.0))
+    {
+      --count;
+    }
+
+    if (count == 0)
+    {
+      // can only happen for degenerate sizes, use the closest pixel
+      left = qBound(0, int(center), sourceSize - 1);
+      weights[0] = 1.0;
+      sum = 1.0;
+      count = 1;
+    }
+
+    taps.first[i] = left;
+    taps.count[i] = count;
+    float * const destinationWeights = taps.weights.data() + i * taps.maxTaps;
+    for (int k=0; k<count; ++k)
+    {
+      destinationWeights[k] = float(weights[k] / sum);
+    }
+  }
+
+  return taps;
+}
+
+/*
+ * Vertical pass: out[i] = sum over k of weights[k] * rows[k][i], for the bytes
+ * of one row.
+ */
+typedef void (*VerticalPassFunction)(const uchar * const *rows, const float *weights, const int count,
+                                     const int length, float *out);
+
+static void verticalPassScalar(const uchar * const *rows, const float *weights, const int count,
+                               const int start, const int length, float *out)
+{
+  for (int i=start; i<length; ++i)
+  {
+    float sum = 0.0f;
+    for (int k=0; k<count; ++k)
+    {
+      sum += weights[k] * rows[k][i];
+    }
+    out[i] = sum;
+  }
+}
+
+#if !defined(IMAGESCALER_SSE2) && !defined(IMAGESCALER_NEON)
+static void verticalPassGeneric(const uchar * const *rows, const float *weights, const int count,
+                                const int length, float *out)
+{
+  verticalPassScalar(rows, weights, count, 0, length, out);
+}
+#endif
+
+#ifdef IMAGESCALER_SSE2
+static void verticalPassSse2(const uchar * const *rows, const float *weights, const int count,
+                             const int length, float *out)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps();
+    __m128 sum3 = _mm_setzero_ps();
+    for (int k=0; k<count; ++k)
+    {
+      const __m128 weight = _mm_set1_ps(weights[k]);
+      const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + i));
+      const __m128i low = _mm_unpacklo_epi8(pixels, zero);
+      const __m128i high = _mm_unpackhi_epi8(pixels, zero);
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero))));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero))));
+      sum2 = _mm_add_ps(sum2, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero))));
+      sum3 = _mm_add_ps(sum3, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero))));
+    }
+    _mm_storeu_ps(out + i, sum0);
+    _mm_storeu_ps(out + i + 4, sum1);
+    _mm_storeu_ps(out + i + 8, sum2);
+    _mm_storeu_ps(out + i + 12, sum3);
+  }
+
+  verticalPassScalar(rows, weights, count, i, length, out);
+}
+#endif
+
+#ifdef IMAGESCALER_AVX2
+__attribute__((target("avx2")))
+static void verticalPassAvx2(const uchar * const *rows, const float *weights, const int count,
+                             const int length, float *out)
+{
+  int i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    for (int k=0; k<count; ++k)
+    {
+      const __m256 weight = _mm256_set1_ps(weights[k]);
+      const __m256i pixels0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + i)));
+      const __m256i pixels1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + i + 8)));
+      sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(weight, _mm256_cvtepi32_ps(pixels0)));
+      sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(weight, _mm256_cvtepi32_ps(pixels1)));
+    }
+    _mm256_storeu_ps(out + i, sum0);
+    _mm256_storeu_ps(out + i + 8, sum1);
+  }
+
+  verticalPassScalar(rows, weights, count, i, length, out);
+}
+#endif
+
+#ifdef IMAGESCALER_NEON
+static void verticalPassNeon(const uchar * const *rows, const float *weights, const int count,
+                             const int length, float *out)
+{
+  int i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    float32x4_t sum0 = vdupq_n_f32(0.0f);
+    float32x4_t sum1 = vdupq_n_f32(0.0f);
+    float32x4_t sum2 = vdupq_n_f32(0.0f);
+    float32x4_t sum3 = vdupq_n_f32(0.0f);
+    for (int k=0; k<count; ++k)
+    {
+      const uint8x16_t pixels = vld1q_u8(rows[k] + i);
+      const uint16x8_t low = vmovl_u8(vget_low_u8(pixels));
+      const uint16x8_t high = vmovl_u8(vget_high_u8(pixels));
+      sum0 = vmlaq_n_f32(sum0, vcvtq_f32_u32(vmovl_u16(vget_low_u16(low))), weights[k]);
+      sum1 = vmlaq_n_f32(sum1, vcvtq_f32_u32(vmovl_u16(vget_high_u16(low))), weights[k]);
+      sum2 = vmlaq_n_f32(sum2, vcvtq_f32_u32(vmovl_u16(vget_low_u16(high))), weights[k]);
+      sum3 = vmlaq_n_f32(sum3, vcvtq_f32_u32(vmovl_u16(vget_high_u16(high))), weights[k]);
+    }
+    vst1q_f32(out + i, sum0);
+    vst1q_f32(out + i + 4, sum1);
+    vst1q_f32(out + i + 8, sum2);
+    vst1q_f32(out + i + 12, sum3);
+  }
+
+  verticalPassScalar(rows, weights, count, i, length, out);
+}
+#endif
+
+static VerticalPassFunction selectVerticalPass()
+{
+#ifdef IMAGESCALER_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return verticalPassAvx2;
+#endif
+#if defined(IMAGESCALER_SSE2)
+  return verticalPassSse2;
+#elif defined(IMAGESCALER_NEON)
+  return verticalPassNeon;
+#else
+  return verticalPassGeneric;
+#endif
+}
+
+/*
+ * Horizontal pass: filters a row of floats with 4 channels per pixel into
+ * the 32 bit output pixels.
+ */
+static void horizontalPass(const float *row, const FilterTaps &taps, const int width, uchar *out)
+{
+  const float *weights = taps.weights.constData();
+  for (int x=0; x<width; ++x, weights += taps.maxTaps, out += 4)
+  {
+    const float *in = row + 4 * taps.first.at(x);
+    const int count = taps.count.at(x);
+
+#if defined(IMAGESCALER_SSE2)
+    __m128 sum = _mm_setzero_ps();
+    for (int k=0; k<count; ++k)
+    {
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(in + 4 * k)));
+    }
+    // rounds, and saturates to 0..255 while packing:
+    __m128i pixel = _mm_cvtps_epi32(sum);
+    pixel = _mm_packs_epi32(pixel, pixel);
+    pixel = _mm_packus_epi16(pixel, pixel);
+    *reinterpret_cast<quint32*>(out) = quint32(_mm_cvtsi128_si32(pixel));
+#elif defined(IMAGESCALER_NEON)
+    float32x4_t sum = vdupq_n_f32(0.5f);
+    for (int k=0; k<count; ++k)
+    {
+      sum = vmlaq_n_f32(sum, vld1q_f32(in + 4 * k), weights[k]);
+    }
+    // negative values saturate to 0 in the conversion, large ones while narrowing:
+    const uint16x4_t pixel16 = vqmovn_u32(vcvtq_u32_f32(sum));
+    const uint8x8_t pixel8 = vqmovn_u16(vcombine_u16(pixel16, pixel16));
+    vst1_lane_u32(reinterpret_cast<uint32_t*>(out), vreinterpret_u32_u8(pixel8), 0);
+#else
+    for (int channel=0; channel<4; ++channel)
+    {
+      float sum = 0.5f;
+      for (int k=0; k<count; ++k)
+      {
+        sum += weights[k] * in[4 * k + channel];
+      }
+      out[channel] = uchar(qBound(0, int(sum), 255));
+    }
+#endif
+  }
+}
+
+void ImageScaler::scale(const uchar *source, const int sourceWidth, const int sourceHeight, const int sourceStride,
+                        uchar *destination, const int destinationWidth, const int destinationHeight,
+                        const int destinationStride, const Filter filter)
+{
+  static const VerticalPassFunction verticalPass = selectVerticalPass();
+
+  // the Lanczos taps grow with the shrink factor, so large shrinks are first
+  // averaged down to twice the destination size, which barely changes the result:
+  if ((filter == LanczosFilter) &&
+      ((sourceWidth > LanczosPrescaleFactor * destinationWidth) ||
+       (sourceHeight > LanczosPrescaleFactor * destinationHeight)))
+  {
+    const int intermediateWidth = qMin(sourceWidth, 2 * destinationWidth);
+    const int intermediateHeight = qMin(sourceHeight, 2 * destinationHeight);
+    QVector<uchar> intermediate(4 * intermediateWidth * intermediateHeight);
+    scale(source, sourceWidth, sourceHeight, sourceStride,
+          intermediate.data(), intermediateWidth, intermediateHeight, 4 * intermediateWidth, AreaFilter);
+    scale(intermediate.constData(), intermediateWidth, intermediateHeight, 4 * intermediateWidth,
+          destination, destinationWidth, destinationHeight, destinationStride, LanczosFilter);
+    return;
+  }
+
+  const FilterTaps horizontalTaps = computeTaps(sourceWidth, destinationWidth, filter);
+  const FilterTaps verticalTaps = computeTaps(sourceHeight, destinationHeight, filter);
+
+  // one row of the vertically filtered image, 4 channels per pixel:
+  QVector<float> row(4 * sourceWidth);
+  QVector<const uchar*> rows(verticalTaps.maxTaps);
+  for (int y=0; y<destinationHeight; ++y)
+  {
+    const int first = verticalTaps.first.at(y);
+    const int count = verticalTaps.count.at(y);
+    for (int k=0; k<count; ++k)
+    {
+      rows[k] = source + (first + k) * sourceStride;
+    }
+
+    verticalPass(rows.constData(), verticalTaps.weights.constData() + y * verticalTaps.maxTaps, count,
+                 4 * sourceWidth, row.data());
+    horizontalPass(row.constData(), horizontalTaps, destinationWidth, destination + y * destinationStride);
+  }
+}
+
+QImage ImageScaler::scaled(const QImage &image, const QSize &size, const Filter filter)
+{
+  if (image.isNull() || size.isEmpty())
+    return QImage();
+
+  const QSize targetSize = image.size().scaled(size, Qt::KeepAspectRatio).expandedTo(QSize(1, 1));
+  if (targetSize == image.size())
+    return image;
+
+  const bool hasAlpha = image.hasAlphaChannel();
+  const QImage::Format format = hasAlpha ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32;
+  const QImage source = (image.format() == format) ? image : image.convertToFormat(format);
+
+  QImage result(targetSize, format);
+  if (result.isNull())
+    return QImage();
+
+  scale(source.bits(), source.width(), source.height(), source.bytesPerLine(),
+        result.bits(), result.width(), result.height(), result.bytesPerLine(), filter);
+
+  if (hasAlpha)
+  {
+    // the negative lobes of the filter can push a color above its alpha, which is invalid when premultiplied:
+    for (int y=0; y<result.height(); ++y)
+    {
+      QRgb *pixel = reinterpret_cast<QRgb*>(result.scanLine(y));
+      for (int x=0; x<result.width(); ++x, ++pixel)
+      {
+        const int alpha = qAlpha(*pixel);
+        *pixel = qRgba(qMin(qRed(*pixel), alpha), qMin(qGreen(*pixel), alpha), qMin(qBlue(*pixel), alpha), alpha);
+      }
+    }
+  }
+
+  return result;
+}
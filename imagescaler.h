@@ -0,0 +1,54 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAGESCALER_H
+#define IMAGESCALER_H
+
+#include <QImage>
+#include <QSize>
+
+/**
+ * High quality image scaling for thumbnails.
+ *
+ * The image is resampled with a separable filter, first vertically into a
+ * single row of floats and then horizontally into the output row, so that
+ * the working set stays in the cache. AreaFilter averages the source pixels
+ * covered by each output pixel, LanczosFilter uses a three lobed Lanczos
+ * window and gives sharper results. Shrinks by more than three times are
+ * averaged down to twice the target size before the Lanczos pass, which
+ * keeps its cost bounded. The inner loops use SSE2 or NEON if the
+ * compiler targets them, and AVX2 for the vertical pass if the CPU has it.
+ *
+ * The kernels work on raw 32 bit pixels, scale() converts the image to
+ * QImage::Format_RGB32 or QImage::Format_ARGB32_Premultiplied first.
+ */
+class ImageScaler
+{
+  public:
+    enum Filter
+    {
+      AreaFilter,
+      LanczosFilter
+    };
+
+    static QImage scaled(const QImage &image, const QSize &size, const Filter filter = LanczosFilter);
+    static void scale(const uchar *source, const int sourceWidth, const int sourceHeight, const int sourceStride,
+                      uchar *destination, const int destinationWidth, const int destinationHeight,
+                      const int destinationStride, const Filter filter);
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "importqueue.h"
+
+ImportQueue::ImportQueue()
+  : m_head(0)
+{
+}
+
+ImportQueue::~ImportQueue()
+{
+  takeAll();
+}
+
+void ImportQueue::push(const Photo &photo)
+{
+  Node * const node = new Node(photo, 0);
+  for (;;)
+  {
+    Node * const head = m_head;
+    node->next = head;
+    if (m_head.testAndSetRelease(head, node))
+      return;
+  }
+}
+
+QList<Photo> ImportQueue::takeAll()
+{
+  // the list is detached as a whole, so nodes are never reused while another thread looks at them:
+  Node *node = m_head.fetchAndStoreAcquire(0);
+
+  // the list holds the newest photo first:
+  QList<Photo> photos;
+  while (node)
+  {
+    photos.prepend(node->photo);
+    Node * const next = node->next;
+    delete node;
+    node = next;
+  }
+  return photos;
+}
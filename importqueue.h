@@ -0,0 +1,62 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMPORTQUEUE_H
+#define IMPORTQUEUE_H
+
+#include <QAtomicPointer>
+#include <QList>
+
+#include "photo.h"
+
+/**
+ * Hands the photos found by the import threads to the GUI thread.
+ *
+ * Any number of threads may push() at the same time without taking a lock,
+ * the photos are kept in a singly linked list whose head is swapped with an
+ * atomic compare-and-swap. Only one thread may take the photos out again:
+ * takeAll() detaches the whole list with a single atomic exchange and returns
+ * the photos in the order in which they were pushed.
+ */
+class ImportQueue
+{
+  public:
+    ImportQueue();
+    ~ImportQueue();
+
+    void push(const Photo &photo);
+    QList<Photo> takeAll();
+
+  private:
+    struct Node
+    {
+      Node(const Photo &nodePhoto, Node *nodeNext)
+        : photo(nodePhoto), next(nodeNext)
+      {
+      }
+
+      Photo photo;
+      Node *next;
+    };
+
+    QAtomicPointer<Node> m_head;
+
+  private:
+    Q_DISABLE_COPY(ImportQueue)
+};
+
+#endif
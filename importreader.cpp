@@ -0,0 +1,582 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "importreader.h"
+#include "exifscanner.h"
+#include "photofile.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <cstring>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <sys/ioctl.h>
+#endif
+
+#ifdef TRIPPY_HAVE_LIBURING
+#include <cerrno>
+#include <liburing.h>
+#endif
+
+class ImportReaderThread : public QThread
+{
+  public:
+    ImportReaderThread(ImportReader *reader, const bool asynchronous)
+      : QThread(), m_reader(reader), m_asynchronous(asynchronous)
+    {
+    }
+
+  protected:
+    void run()
+    {
+      if (m_asynchronous)
+        m_reader->runAsynchronous();
+      else
+        m_reader->runBlocking();
+    }
+
+  private:
+    ImportReader *m_reader;
+    bool m_asynchronous;
+
+  private:
+    Q_DISABLE_COPY(ImportReaderThread)
+};
+
+ImportReader::ImportReader(const QStringList &filenames, const int queueDepth, const qint64 bufferBudget)
+  : m_requests(filenames.size()), m_indices(), m_nextRequest(0), m_queueDepth(qMax(queueDepth, 1)), m_readAhead(0),
+    m_bufferBudget(bufferBudget), m_bufferedBytes(0), m_stopping(false), m_skipFunction(0), m_skipData(0),
+    m_mutex(), m_requestFinished(), m_bufferReleased(), m_threads()
+{
+  for (int i=0; i<filenames.size(); ++i)
+  {
+    Request &request = m_requests[i];
+    request.filename = filenames.at(i);
+    request.state = Pending;
+
+    // a file which is imported twice is only read once:
+    if (m_indices.contains(request.filename))
+      request.state = Taken;
+    else
+      m_indices.insert(request.filename, i);
+  }
+}
+
+ImportReader::~ImportReader()
+{
+  stop();
+}
+
+void ImportReader::setSkipFunction(SkipFunction skipFunction, void *yourdata)
+{
+  m_skipFunction = skipFunction;
+  m_skipData = yourdata;
+}
+
+// number of files beyond the current one which the kernel should prefetch, 0 disables the hints
+void ImportReader::setReadAhead(const int files)
+{
+  m_readAhead = qMax(files, 0);
+}
+
+void ImportReader::start()
+{
+  if (!m_threads.isEmpty())
+    return;
+
+  // one thread drives the whole queue with io_uring, otherwise every outstanding read needs its own thread:
+  const bool asynchronous = isAsynchronous();
+  const int threadCount = asynchronous ? 1 : m_queueDepth;
+  qDebug() << "ImportReader: reading" << m_requests.size() << "files with queue depth" << m_queueDepth
+           << (asynchronous ? "using io_uring" : "using reader threads");
+
+  for (int i=0; i<threadCount; ++i)
+  {
+    QThread *thread = new ImportReaderThread(this, asynchronous);
+    m_threads.append(thread);
+    thread->start();
+  }
+}
+
+void ImportReader::stop()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_stopping = true;
+    m_bufferReleased.wakeAll();
+    m_requestFinished.wakeAll();
+  }
+
+  for (QList<QThread*>::const_iterator it = m_threads.constBegin(); it!=m_threads.constEnd(); ++it)
+  {
+    (*it)->wait();
+    delete *it;
+  }
+  m_threads.clear();
+}
+
+/*
+ * Hands the contents of a file to a worker. Waits until the file has been
+ * read, returns false if the worker has to read the file itself.
+ *
+ * The readers claim the files in order, so a file which has not been
+ * started yet is claimed as soon as the readers are done with the files in
+ * front of it. Only if the buffer budget is used up, the readers might wait
+ * for buffers which nobody takes anymore, for example after the import was
+ * canceled. In that case the worker does not wait either.
+ */
+bool ImportReader::take(const QString &filename, QByteArray *contents)
+{
+  QMutexLocker locker(&m_mutex);
+
+  const int index = m_indices.value(filename, -1);
+  if (index < 0)
+    return false;
+
+  Request &request = m_requests[index];
+  while ((request.state == Reading) ||
+         ((request.state == Pending) && !m_stopping && (m_bufferedBytes < m_bufferBudget)))
+  {
+    m_requestFinished.wait(&m_mutex);
+  }
+
+  if (request.state != Done)
+  {
+    // skipped, failed or not started, the reader will not touch this file anymore
+    request.state = Taken;
+    return false;
+  }
+
+  *contents = request.contents;
+  request.contents = QByteArray();
+  request.state = Taken;
+  m_bufferedBytes -= contents->size();
+  m_bufferReleased.wakeAll();
+  return true;
+}
+
+bool ImportReader::isAsynchronous()
+{
+#ifdef TRIPPY_HAVE_LIBURING
+  // the kernel may be too old, or io_uring may be disabled:
+  struct io_uring ring;
+  if (io_uring_queue_init(1, &ring, 0) < 0)
+    return false;
+
+  io_uring_queue_exit(&ring);
+  return true;
+#else
+  return false;
+#endif
+}
+
+struct DiskLocation
+{
+  quint64 device;
+  bool hasExtent;
+  quint64 position;
+  QString filename;
+
+  bool operator<(const DiskLocation &other) const
+  {
+    if (device != other.device)
+      return device < other.device;
+    if (hasExtent != other.hasExtent)
+      return hasExtent;
+    return position < other.position;
+  }
+};
+
+/*
+ * Orders the files by the position of their first block on the disk, so that
+ * a rotating disk can read them with few seeks. If the file system does not
+ * report extents, the inode number is used as an approximation instead.
+ */
+QStringList ImportReader::sortByDiskLocation(const QStringList &filenames)
+{
+#ifdef Q_OS_LINUX
+  QVector<DiskLocation> locations;
+  locations.reserve(filenames.size());
+  for (QStringList::const_iterator it = filenames.constBegin(); it!=filenames.constEnd(); ++it)
+  {
+    DiskLocation location;
+    location.device = 0;
+    location.hasExtent = false;
+    location.position = 0;
+    location.filename = *it;
+
+    const int fd = ::open(QFile::encodeName(*it).constData(), O_RDONLY | O_CLOEXEC);
+    struct stat fileStat;
+    if ((fd >= 0) && (::fstat(fd, &fileStat) == 0))
+    {
+      location.device = fileStat.st_dev;
+      location.position = fileStat.st_ino;
+
+      // room for the header and a single extent, only the first one is of interest:
+      quint64 buffer[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(quint64)];
+      memset(buffer, 0, sizeof(buffer));
+      struct fiemap * const request = reinterpret_cast<struct fiemap*>(buffer);
+      request->fm_start = 0;
+      request->fm_length = FIEMAP_MAX_OFFSET;
+      request->fm_extent_count = 1;
+      if ((::ioctl(fd, FS_IOC_FIEMAP, request) == 0) && (request->fm_mapped_extents > 0))
+      {
+        location.hasExtent = true;
+        location.position = request->fm_extents[0].fe_physical;
+      }
+    }
+    if (fd >= 0)
+      ::close(fd);
+
+    locations.append(location);
+  }
+
+  // files with the same location keep their order:
+  std::stable_sort(locations.begin(), locations.end());
+
+  QStringList sorted;
+  for (QVector<DiskLocation>::const_iterator it = locations.constBegin(); it!=locations.constEnd(); ++it)
+  {
+    sorted.append(it->filename);
+  }
+  return sorted;
+#else
+  return filenames;
+#endif
+}
+
+/*
+ * Returns the index of the next file to read, or -1 if there is none right
+ * now. While the buffer budget is used up, the call either waits or returns
+ * -1 immediately, depending on wait.
+ */
+int ImportReader::claimRequest(const bool wait, QString *filename, bool *finished)
+{
+  QMutexLocker locker(&m_mutex);
+
+  forever
+  {
+    while ((m_nextRequest < m_requests.size()) && (m_requests.at(m_nextRequest).state != Pending))
+    {
+      ++m_nextRequest;
+    }
+
+    *finished = m_stopping || (m_nextRequest >= m_requests.size());
+    if (*finished)
+      return -1;
+
+    if (m_bufferedBytes < m_bufferBudget)
+    {
+      Request &request = m_requests[m_nextRequest];
+      request.state = Reading;
+      *filename = request.filename;
+      return m_nextRequest++;
+    }
+
+    if (!wait)
+      return -1;
+
+    m_bufferReleased.wait(&m_mutex);
+  }
+}
+
+bool ImportReader::isSkipped(const QString &filename) const
+{
+  return m_skipFunction && m_skipFunction(filename, m_skipData);
+}
+
+// asks the kernel to fetch a file further down the list into the page cache, without waiting for it
+void ImportReader::adviseReadAhead(const int index) const
+{
+#if defined(Q_OS_LINUX) && defined(POSIX_FADV_WILLNEED)
+  const int aheadIndex = index + m_readAhead;
+  if ((m_readAhead == 0) || (aheadIndex >= m_requests.size()))
+    return;
+
+  // the file names do not change after construction, no need to lock:
+  const QString &filename = m_requests.at(aheadIndex).filename;
+  const int fd = ::open(QFile::encodeName(filename).constData(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  ::close(fd);
+#else
+  Q_UNUSED(index);
+#endif
+}
+
+void ImportReader::finishRequest(const int index, const QByteArray &contents, const bool ok)
+{
+  QMutexLocker locker(&m_mutex);
+
+  Request &request = m_requests[index];
+  if (ok)
+  {
+    request.contents = contents;
+    request.state = Done;
+    m_bufferedBytes += contents.size();
+  }
+  else
+  {
+    request.state = Failed;
+  }
+
+  m_requestFinished.wakeAll();
+}
+
+/*
+ * Returns the size the start of a file has to have for the EXIF scanner. If
+ * the EXIF segment does not end within the header, it is read up to its end.
+ * Files whose EXIF data is too large for the scanner are left to Exiv2.
+ */
+qint64 ImportReader::requiredHeaderSize(const QByteArray &header, const qint64 fileSize)
+{
+  ExifScanner scanner;
+  if (scanner.scan(reinterpret_cast<const uchar*>(header.constData()), header.size()) != ExifScanner::Truncated)
+    return header.size();
+
+  if (scanner.requiredSize() > ExifScanner::maximumReadSize())
+    return header.size();
+
+  return qMin(scanner.requiredSize(), fileSize);
+}
+
+// reads the start of the file, up to the end of its EXIF data
+bool ImportReader::readHeader(const QString &filename, QByteArray *contents)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  *contents = file.read(ExifScanner::initialReadSize());
+  forever
+  {
+    const qint64 required = requiredHeaderSize(*contents, file.size());
+    if (required <= contents->size())
+      break;
+
+    const QByteArray more = file.read(required - contents->size());
+    if (more.isEmpty())
+      break;
+
+    *contents += more;
+  }
+
+  IoStatistics::addBytes(IoStatistics::MetadataStage, contents->size());
+  return !contents->isEmpty();
+}
+
+void ImportReader::runBlocking()
+{
+  forever
+  {
+    QString filename;
+    bool finished = false;
+    const int index = claimRequest(true, &filename, &finished);
+    if (finished)
+      return;
+
+    adviseReadAhead(index);
+    if (isSkipped(filename))
+    {
+      finishRequest(index, QByteArray(), false);
+      continue;
+    }
+
+    QByteArray contents;
+    const bool ok = readHeader(filename, &contents);
+    finishRequest(index, contents, ok);
+  }
+}
+
+#ifdef TRIPPY_HAVE_LIBURING
+struct AsyncRead
+{
+  int slot;
+  int index;
+  int fd;
+  qint64 fileSize;
+  QByteArray contents;
+  qint64 done;
+};
+
+// queues a read for the part of the file which is still missing
+static bool submitAsyncRead(struct io_uring *ring, AsyncRead *read)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+  if (!sqe)
+    return false;
+
+  io_uring_prep_read(sqe, read->fd, read->contents.data() + read->done, read->contents.size() - read->done, read->done);
+  io_uring_sqe_set_data(sqe, read);
+  return true;
+}
+#endif
+
+void ImportReader::runAsynchronous()
+{
+#ifdef TRIPPY_HAVE_LIBURING
+  struct io_uring ring;
+  if (io_uring_queue_init(m_queueDepth, &ring, 0) < 0)
+  {
+    runBlocking();
+    return;
+  }
+
+  // the buffers must stay in place while the kernel writes into them:
+  QVector<AsyncRead> reads(m_queueDepth);
+  QList<int> freeSlots;
+  for (int i=0; i<m_queueDepth; ++i)
+  {
+    reads[i].slot = i;
+    freeSlots.append(i);
+  }
+
+  int inFlight = 0;
+  bool finished = false;
+  forever
+  {
+    // keep the queue filled, but only block for new requests if nothing is in flight:
+    bool submitted = false;
+    while (!finished && !freeSlots.isEmpty())
+    {
+      QString filename;
+      const int index = claimRequest(inFlight == 0, &filename, &finished);
+      if (index < 0)
+        break;
+
+      adviseReadAhead(index);
+      if (isSkipped(filename))
+      {
+        finishRequest(index, QByteArray(), false);
+        continue;
+      }
+
+      struct stat fileStat;
+      const int fd = ::open(QFile::encodeName(filename).constData(), O_RDONLY | O_CLOEXEC);
+      if ((fd < 0) || (::fstat(fd, &fileStat) != 0) || (fileStat.st_size <= 0))
+      {
+        if (fd >= 0)
+          ::close(fd);
+        finishRequest(index, QByteArray(), false);
+        continue;
+      }
+
+      AsyncRead &read = reads[freeSlots.takeLast()];
+      read.index = index;
+      read.fd = fd;
+      read.fileSize = fileStat.st_size;
+      read.contents.resize(qMin(qint64(fileStat.st_size), ExifScanner::initialReadSize()));
+      read.done = 0;
+      if (!submitAsyncRead(&ring, &read))
+      {
+        ::close(fd);
+        read.contents = QByteArray();
+        freeSlots.append(read.slot);
+        finishRequest(index, QByteArray(), false);
+        break;
+      }
+
+      ++inFlight;
+      submitted = true;
+    }
+
+    if (submitted)
+      io_uring_submit(&ring);
+
+    if (inFlight == 0)
+    {
+      if (finished)
+        break;
+      continue;
+    }
+
+    struct io_uring_cqe *cqe = 0;
+    const int waitResult = io_uring_wait_cqe(&ring, &cqe);
+    if (waitResult == -EINTR)
+      continue;
+    if (waitResult < 0)
+    {
+      qWarning() << "ImportReader: io_uring failed with error" << -waitResult;
+      break;
+    }
+
+    AsyncRead *read = static_cast<AsyncRead*>(io_uring_cqe_get_data(cqe));
+    const int result = cqe->res;
+    io_uring_cqe_seen(&ring, cqe);
+
+    // short reads are continued where they stopped, and the header is extended up to the end of the EXIF data:
+    if (result > 0)
+    {
+      read->done += result;
+      if (read->done == read->contents.size())
+      {
+        read->contents.resize(requiredHeaderSize(read->contents, read->fileSize));
+      }
+      if ((read->done < read->contents.size()) && submitAsyncRead(&ring, read))
+      {
+        io_uring_submit(&ring);
+        continue;
+      }
+    }
+
+    ::close(read->fd);
+    const bool ok = (result >= 0) && (read->done > 0);
+    if (ok)
+    {
+      read->contents.resize(read->done);
+      IoStatistics::addBytes(IoStatistics::MetadataStage, read->done);
+    }
+    finishRequest(read->index, read->contents, ok);
+    read->contents = QByteArray();
+    freeSlots.append(read->slot);
+    --inFlight;
+  }
+
+  // only reached with reads in flight if the ring broke, let the workers read those files themselves:
+  for (QVector<AsyncRead>::iterator it = reads.begin(); (inFlight > 0) && (it!=reads.end()); ++it)
+  {
+    if (!freeSlots.contains(it->slot))
+    {
+      ::close(it->fd);
+      finishRequest(it->index, QByteArray(), false);
+      --inFlight;
+    }
+  }
+
+  io_uring_queue_exit(&ring);
+
+  // the ring is gone, but files may still be waiting:
+  if (!finished)
+    runBlocking();
+#else
+  runBlocking();
+#endif
+}
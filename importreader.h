@@ -0,0 +1,120 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMPORTREADER_H
+#define IMPORTREADER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QWaitCondition>
+
+class QThread;
+
+/**
+ * Reads the files of an import ahead of the workers which parse them.
+ *
+ * Only the start of every file is read, up to the end of its EXIF data. The
+ * thumbnails are created from the whole file later on by the
+ * ThumbnailScheduler. The files are read in the order given, with up to
+ * queueDepth reads in flight. On Linux the reads are submitted through io_uring if Trippy was
+ * built with liburing, otherwise queueDepth blocking reader threads are used.
+ * These threads are separate from the global thread pool, so the number of
+ * outstanding reads and the number of decoding threads can be tuned
+ * independently. At most bufferBudget bytes of completed reads are held in
+ * memory before the reader waits for the workers to take them.
+ *
+ * Files for which the skip function returns true are not read at all, the
+ * workers can use their cached data instead. take() waits until the readers
+ * have read the file, so the reads stay on the reader threads even if the
+ * workers are faster than the disk. It never fails hard: if a file was
+ * skipped or could not be read, or the readers stopped, it returns false and
+ * the worker reads the EXIF data itself.
+ *
+ * With setReadAhead() the kernel is asked to prefetch the files beyond the
+ * queue into the page cache, which mostly helps on rotating disks when the
+ * files were ordered with sortByDiskLocation().
+ */
+class ImportReader
+{
+  public:
+    typedef bool (*SkipFunction)(const QString &filename, void *yourdata);
+
+    ImportReader(const QStringList &filenames, const int queueDepth, const qint64 bufferBudget);
+    ~ImportReader();
+
+    void setSkipFunction(SkipFunction skipFunction, void *yourdata);
+    void setReadAhead(const int files);
+    void start();
+    void stop();
+    bool take(const QString &filename, QByteArray *contents);
+
+    static bool isAsynchronous();
+    static QStringList sortByDiskLocation(const QStringList &filenames);
+
+  private:
+    enum State
+    {
+      Pending,  // not read yet
+      Reading,  // claimed by a reader
+      Done,     // contents are ready
+      Failed,   // skipped or not readable
+      Taken     // handed to a worker, or the worker reads it itself
+    };
+
+    struct Request
+    {
+      QString filename;
+      State state;
+      QByteArray contents;
+    };
+
+    friend class ImportReaderThread;
+
+    int claimRequest(const bool wait, QString *filename, bool *finished);
+    bool isSkipped(const QString &filename) const;
+    void adviseReadAhead(const int index) const;
+    void finishRequest(const int index, const QByteArray &contents, const bool ok);
+    void runBlocking();
+    void runAsynchronous();
+    static qint64 requiredHeaderSize(const QByteArray &header, const qint64 fileSize);
+    static bool readHeader(const QString &filename, QByteArray *contents);
+
+    QVector<Request> m_requests;
+    QHash<QString, int> m_indices;
+    int m_nextRequest;
+    int m_queueDepth;
+    int m_readAhead;
+    qint64 m_bufferBudget;
+    qint64 m_bufferedBytes;
+    bool m_stopping;
+    SkipFunction m_skipFunction;
+    void *m_skipData;
+    QMutex m_mutex;
+    QWaitCondition m_requestFinished;
+    QWaitCondition m_bufferReleased;
+    QList<QThread*> m_threads;
+
+  private:
+    Q_DISABLE_COPY(ImportReader)
+};
+
+#endif
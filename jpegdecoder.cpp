@@ -0,0 +1,276 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jpegdecoder.h"
+#include "photofile.h"
+
+#include <QByteArray>
+#include <QFile>
+
+#include <csetjmp>
+#include <cstdio>
+
+extern "C"
+{
+#include <jpeglib.h>
+}
+
+struct JpegErrorManager
+{
+  struct jpeg_error_mgr manager;
+  jmp_buf jumpBuffer;
+};
+
+extern "C"
+{
+static void jpegErrorExit(j_common_ptr cinfo)
+{
+  JpegErrorManager * const errorManager = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+  longjmp(errorManager->jumpBuffer, 1);
+}
+
+static void jpegOutputMessage(j_common_ptr)
+{
+  // warnings about corrupt data are not interesting for thumbnails
+}
+
+// source manager for data which is already in memory
+static void jpegInitSource(j_decompress_ptr)
+{
+}
+
+static boolean jpegFillInputBuffer(j_decompress_ptr cinfo)
+{
+  // we ran out of data, insert a fake EOI marker like libjpeg does for files:
+  static const JOCTET endOfImage[2] = { 0xFF, JPEG_EOI };
+  cinfo->src->next_input_byte = endOfImage;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void jpegSkipInputData(j_decompress_ptr cinfo, long count)
+{
+  if (count <= 0)
+    return;
+
+  if (static_cast<size_t>(count) > cinfo->src->bytes_in_buffer)
+  {
+    jpegFillInputBuffer(cinfo);
+    return;
+  }
+
+  cinfo->src->next_input_byte += count;
+  cinfo->src->bytes_in_buffer -= count;
+}
+
+static void jpegTermSource(j_decompress_ptr)
+{
+}
+}
+
+/*
+ * Returns the denominator of the smallest DCT scale factor whose output
+ * still covers the area the image will be scaled to.
+ */
+static int jpegScaleDenominator(const QSize &imageSize, const QSize &size)
+{
+  const QSize neededSize = imageSize.scaled(size, Qt::KeepAspectRatio);
+
+  for (int denominator = 8; denominator > 1; denominator /= 2)
+  {
+    const int scaledWidth = (imageSize.width() + denominator - 1) / denominator;
+    const int scaledHeight = (imageSize.height() + denominator - 1) / denominator;
+    if ((scaledWidth >= neededSize.width()) && (scaledHeight >= neededSize.height()))
+      return denominator;
+  }
+
+  return 1;
+}
+
+QImage JpegDecoder::decodeScaled(const QString &filename, const QSize &size)
+{
+  FILE * const file = fopen(QFile::encodeName(filename).constData(), "rb");
+  if (!file)
+    return QImage();
+
+  const QImage image = decode(file, 0, 0, size);
+  IoStatistics::addBytes(IoStatistics::ThumbnailStage, ftell(file));
+  fclose(file);
+
+  return image;
+}
+
+QImage JpegDecoder::decodeScaled(const uchar *data, const qint64 dataSize, const QSize &size)
+{
+  return decode(0, data, dataSize, size);
+}
+
+/*
+ * The state of libjpeg while decoding. It has no destructor, so that the
+ * helpers below can longjmp() out of libjpeg safely. Every helper sets its
+ * own jump target, and none of them has local objects with destructors.
+ */
+struct JpegDecompressor
+{
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_source_mgr memorySource;
+  JpegErrorManager errorManager;
+  bool grayscale;
+};
+
+/*
+ * Reads the header and starts the decompression at the DCT scale for the
+ * given size. On success, the output size is in cinfo.output_width and
+ * cinfo.output_height, on failure the decompressor is already destroyed.
+ */
+static bool startJpegDecompress(JpegDecompressor *decompressor, FILE *file, const uchar *data, const qint64 dataSize,
+                                const int width, const int height)
+{
+  struct jpeg_decompress_struct * const cinfo = &decompressor->cinfo;
+  cinfo->err = jpeg_std_error(&decompressor->errorManager.manager);
+  decompressor->errorManager.manager.error_exit = jpegErrorExit;
+  decompressor->errorManager.manager.output_message = jpegOutputMessage;
+
+  if (setjmp(decompressor->errorManager.jumpBuffer))
+  {
+    // libjpeg ran into an error while decoding:
+    jpeg_destroy_decompress(cinfo);
+    return false;
+  }
+
+  jpeg_create_decompress(cinfo);
+  if (file)
+  {
+    jpeg_stdio_src(cinfo, file);
+  }
+  else
+  {
+    struct jpeg_source_mgr * const memorySource = &decompressor->memorySource;
+    memorySource->init_source = jpegInitSource;
+    memorySource->fill_input_buffer = jpegFillInputBuffer;
+    memorySource->skip_input_data = jpegSkipInputData;
+    memorySource->resync_to_restart = jpeg_resync_to_restart;
+    memorySource->term_source = jpegTermSource;
+    memorySource->next_input_byte = data;
+    memorySource->bytes_in_buffer = dataSize;
+    cinfo->src = memorySource;
+  }
+  jpeg_read_header(cinfo, TRUE);
+
+  if ((cinfo->jpeg_color_space != JCS_GRAYSCALE) && (cinfo->jpeg_color_space != JCS_YCbCr) && (cinfo->jpeg_color_space != JCS_RGB))
+  {
+    // CMYK and friends are left to Qt
+    jpeg_destroy_decompress(cinfo);
+    return false;
+  }
+
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = jpegScaleDenominator(QSize(cinfo->image_width, cinfo->image_height), QSize(width, height));
+  cinfo->dct_method = JDCT_IFAST;
+  cinfo->do_fancy_upsampling = FALSE;
+
+  decompressor->grayscale = (cinfo->jpeg_color_space == JCS_GRAYSCALE);
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo can write directly into the layout of QImage::Format_RGB32:
+  if (!decompressor->grayscale)
+  {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    cinfo->out_color_space = JCS_EXT_BGRX;
+#else
+    cinfo->out_color_space = JCS_EXT_XRGB;
+#endif
+  }
+#else
+  cinfo->out_color_space = decompressor->grayscale ? JCS_GRAYSCALE : JCS_RGB;
+#endif
+
+  jpeg_start_decompress(cinfo);
+  return true;
+}
+
+/*
+ * Decodes the scanlines into the 32 bit pixels of the caller, rowBuffer has
+ * to hold one row of output_components bytes per pixel. The decompressor is
+ * destroyed in any case.
+ */
+static bool readJpegScanlines(JpegDecompressor *decompressor, uchar *pixels, const int bytesPerLine, uchar *rowBuffer)
+{
+  struct jpeg_decompress_struct * const cinfo = &decompressor->cinfo;
+  if (setjmp(decompressor->errorManager.jumpBuffer))
+  {
+    jpeg_destroy_decompress(cinfo);
+    return false;
+  }
+
+  const bool directOutput = (cinfo->output_components == 4);
+  while (cinfo->output_scanline < cinfo->output_height)
+  {
+    QRgb * const destination = reinterpret_cast<QRgb*>(pixels + qint64(cinfo->output_scanline) * bytesPerLine);
+    if (directOutput)
+    {
+      JSAMPROW row = reinterpret_cast<JSAMPROW>(destination);
+      jpeg_read_scanlines(cinfo, &row, 1);
+      continue;
+    }
+
+    JSAMPROW row = rowBuffer;
+    jpeg_read_scanlines(cinfo, &row, 1);
+    const uchar *source = rowBuffer;
+    for (JDIMENSION x = 0; x < cinfo->output_width; ++x)
+    {
+      if (decompressor->grayscale)
+      {
+        destination[x] = qRgb(source[0], source[0], source[0]);
+        source += 1;
+      }
+      else
+      {
+        destination[x] = qRgb(source[0], source[1], source[2]);
+        source += 3;
+      }
+    }
+  }
+
+  jpeg_finish_decompress(cinfo);
+  jpeg_destroy_decompress(cinfo);
+  return true;
+}
+
+/*
+ * Decodes either from file or from data, depending on which one is given.
+ * The objects with destructors live here, libjpeg only runs in the helpers
+ * above, which longjmp() back into their own frames on errors.
+ */
+QImage JpegDecoder::decode(FILE *file, const uchar *data, const qint64 dataSize, const QSize &size)
+{
+  JpegDecompressor decompressor;
+  if (!startJpegDecompress(&decompressor, file, data, dataSize, size.width(), size.height()))
+    return QImage();
+
+  QImage image(decompressor.cinfo.output_width, decompressor.cinfo.output_height, QImage::Format_RGB32);
+  QByteArray rowBuffer(decompressor.cinfo.output_width * decompressor.cinfo.output_components, 0);
+  if (image.isNull())
+  {
+    jpeg_destroy_decompress(&decompressor.cinfo);
+    return QImage();
+  }
+
+  if (!readJpegScanlines(&decompressor, image.bits(), image.bytesPerLine(), reinterpret_cast<uchar*>(rowBuffer.data())))
+    return QImage();
+
+  return image;
+}
@@ -0,0 +1,45 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include <cstdio>
+
+/**
+ * Decodes JPEG files at a reduced size using the DCT scaling of libjpeg.
+ *
+ * The smallest of the scale factors 1/8, 1/4, 1/2 and 1/1 which still
+ * covers the requested size is used, the caller does the final resampling.
+ * Returns a null image for files libjpeg can not decode into RGB, for
+ * example CMYK images.
+ */
+class JpegDecoder
+{
+  public:
+    static QImage decodeScaled(const QString &filename, const QSize &size);
+    static QImage decodeScaled(const uchar *data, const qint64 dataSize, const QSize &size);
+
+  private:
+    static QImage decode(FILE *file, const uchar *data, const qint64 dataSize, const QSize &size);
+};
+
+#endif
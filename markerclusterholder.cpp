@@ -22,8 +22,11 @@
 
 // C++ includes
 #include <algorithm>
+#include <cmath>
+#include <set>
 
 // Qt includes
+#include <QHash>
 #include <QMouseEvent>
 #include <QToolTip>
 
@@ -37,6 +40,7 @@
 // local includes
 #include "markerclusterholder.h"
 #include "markerclusterholder.moc"
+#include "markerprojection.h"
 
 // externaldraw plugin only supported on version 0.8 or higher
 #if MARBLE_VERSION >= 0x000800
@@ -46,15 +50,518 @@
 // constants for clusters
 const int ClusterRadius = 15;
 const QSize ClusterDefaultSize = QSize(2*ClusterRadius, 2*ClusterRadius);
-const int ClusterGridSizeScreen = 60;
 const QSize ClusterMaxPixmapSize = QSize(60, 60);
 
+const int MarkerClusterHolder::ClusterGridSizeScreen;
+
+// number of levels of the marker hierarchy below the coarsest one
+const int MarkerHierarchyLevels = 24;
+
+/**
+ * @brief A rectangle of latitudes and longitudes in degrees
+ *
+ * west is larger than east if the rectangle crosses the date line.
+ */
+struct LatLonBox
+{
+  qreal west;
+  qreal east;
+  qreal south;
+  qreal north;
+};
+
+/**
+ * @brief Helper function, returns the index of the cell of the finest level of MarkerHierarchy
+ * @param degrees Longitude+180 or latitude+90
+ */
+static quint32 markerHierarchyIndex(const qreal degrees)
+{
+  const int cellsAround = 1<<MarkerHierarchyLevels;
+  return qBound(0, int(degrees/360.0*cellsAround), cellsAround-1);
+}
+
+/**
+ * @brief Helper function, spreads the lower 32 bits of a number to the even bits
+ */
+static quint64 spreadBits(quint64 x)
+{
+  x &= Q_UINT64_C(0x00000000FFFFFFFF);
+  x = (x | (x<<16)) & Q_UINT64_C(0x0000FFFF0000FFFF);
+  x = (x | (x<<8)) & Q_UINT64_C(0x00FF00FF00FF00FF);
+  x = (x | (x<<4)) & Q_UINT64_C(0x0F0F0F0F0F0F0F0F);
+  x = (x | (x<<2)) & Q_UINT64_C(0x3333333333333333);
+  x = (x | (x<<1)) & Q_UINT64_C(0x5555555555555555);
+  return x;
+}
+
+/**
+ * @brief Helper function, returns the position of a marker along the Z-order curve of the finest level of MarkerHierarchy
+ */
+static quint64 markerCode(const MarkerClusterHolder::MarkerInfo& marker)
+{
+  return spreadBits(markerHierarchyIndex(marker.lon()+180.0)) | (spreadBits(markerHierarchyIndex(marker.lat()+90.0))<<1);
+}
+
+/**
+ * @brief Helper function, determines the cells of a level which cover a rectangle
+ *
+ * @param box Rectangle of latitudes and longitudes
+ * @param level Level of the MarkerHierarchy
+ * @param rowStart First row is stored here
+ * @param rowEnd Last row is stored here
+ * @param columnRanges First and last column of each range of columns are stored here,
+ *                     a rectangle across the date line is split in two
+ */
+static void latLonBoxCells(const LatLonBox& box, const int level, int* const rowStart, int* const rowEnd, QList<QPair<int, int> >* const columnRanges)
+{
+  const qreal cellSize = 360.0/(1<<level);
+  const int lastIndex = (1<<level)-1;
+  *rowStart = qBound(0, int((box.south+90.0)/cellSize), lastIndex);
+  *rowEnd = qBound(0, int((box.north+90.0)/cellSize), lastIndex);
+  const int columnStart = qBound(0, int((box.west+180.0)/cellSize), lastIndex);
+  const int columnEnd = qBound(0, int((box.east+180.0)/cellSize), lastIndex);
+  
+  columnRanges->clear();
+  if (box.west<=box.east)
+  {
+    *columnRanges << QPair<int, int>(columnStart, columnEnd);
+  }
+  else if (columnStart<=columnEnd)
+  {
+    // both ends of the rectangle are in the same column
+    *columnRanges << QPair<int, int>(0, lastIndex);
+  }
+  else
+  {
+    *columnRanges << QPair<int, int>(0, columnEnd) << QPair<int, int>(columnStart, lastIndex);
+  }
+}
+
+/**
+ * @brief Spatial index over the markers
+ *
+ * The markers are kept sorted along the Z-order curve of the finest level of
+ * the MarkerHierarchy, so the markers inside a rectangle of latitudes and
+ * longitudes are found with a few binary searches. The index follows every
+ * change of the list of markers. A change costs one pass over the index,
+ * because the indices of the following markers shift, but the index is never
+ * sorted again as a whole.
+ */
+class MarkerIndex
+{
+  public:
+    //! position along the Z-order curve and index of a marker
+    typedef QPair<quint64, int> Entry;
+
+    MarkerIndex()
+    : m_entries()
+    {
+    }
+
+    /**
+     * @brief Removes all markers from the index
+     */
+    void clear()
+    {
+      m_entries.clear();
+    }
+
+    void setMarkers(const MarkerClusterHolder::MarkerInfo::List& markers);
+    void insertMarkers(const int index, const MarkerClusterHolder::MarkerInfo::List& markerList);
+    void moveMarkers(const int start, const int end, const int destination);
+    void removeMarkers(const int start, const int end);
+    void removeMarkers(const QList<int>& markerIndices);
+    QVector<int> markersIn(const LatLonBox& box) const;
+
+    /**
+     * @brief Returns the markers sorted along the Z-order curve, markers with the same position are in no particular order
+     */
+    const QVector<Entry>& entries() const
+    {
+      return m_entries;
+    }
+
+  private:
+    QVector<Entry> m_entries;
+
+  private:
+    Q_DISABLE_COPY(MarkerIndex)
+};
+
+/**
+ * @brief Helper function for sorting MarkerIndex entries by their position only
+ */
+inline bool MarkerIndexEntryLessThan(const MarkerIndex::Entry& one, const MarkerIndex::Entry& two)
+{
+  return one.first<two.first;
+}
+
+/**
+ * @brief Replaces all markers in the index
+ * @param markers The new markers
+ */
+void MarkerIndex::setMarkers(const MarkerClusterHolder::MarkerInfo::List& markers)
+{
+  m_entries.clear();
+  insertMarkers(0, markers);
+}
+
+/**
+ * @brief Inserts markers in front of a given index
+ * @param index Index of the marker in front of which the markers are inserted
+ * @param markerList List of markers to be inserted
+ */
+void MarkerIndex::insertMarkers(const int index, const MarkerClusterHolder::MarkerInfo::List& markerList)
+{
+  // nothing to shift if the markers are appended:
+  const int count = markerList.count();
+  for (QVector<Entry>::iterator it = m_entries.begin(); (index<m_entries.size())&&(it!=m_entries.end()); ++it)
+  {
+    if (it->second>=index)
+      it->second += count;
+  }
+  
+  QVector<Entry> newEntries;
+  newEntries.reserve(count);
+  for (int i=0; i<count; ++i)
+  {
+    newEntries << Entry(markerCode(markerList.at(i)), index+i);
+  }
+  std::sort(newEntries.begin(), newEntries.end(), MarkerIndexEntryLessThan);
+  
+  const int oldSize = m_entries.size();
+  m_entries += newEntries;
+  std::inplace_merge(m_entries.begin(), m_entries.begin()+oldSize, m_entries.end(), MarkerIndexEntryLessThan);
+}
+
+/**
+ * @brief Moves a range of markers
+ *
+ * Same semantics as MarkerClusterHolder::moveMarkers.
+ *
+ * @param start Start index
+ * @param end End index (inclusive!)
+ * @param destination Index of the marker in front of which the range is moved, counted before the move
+ */
+void MarkerIndex::moveMarkers(const int start, const int end, const int destination)
+{
+  if ((destination>=start)&&(destination<=end+1))
+    return;
+  
+  const int count = end-start+1;
+  for (QVector<Entry>::iterator it = m_entries.begin(); it!=m_entries.end(); ++it)
+  {
+    int& index = it->second;
+    if ((index>=start)&&(index<=end))
+    {
+      index += (destination<start) ? destination-start : destination-count-start;
+    }
+    else if ((destination<start)&&(index>=destination)&&(index<start))
+    {
+      index += count;
+    }
+    else if ((destination>end)&&(index>end)&&(index<destination))
+    {
+      index -= count;
+    }
+  }
+}
+
+/**
+ * @brief Removes a range of markers
+ * @param start Start index
+ * @param end End index (inclusive!)
+ */
+void MarkerIndex::removeMarkers(const int start, const int end)
+{
+  const int count = end-start+1;
+  QVector<Entry> keptEntries;
+  keptEntries.reserve(m_entries.size());
+  for (QVector<Entry>::const_iterator it = m_entries.constBegin(); it!=m_entries.constEnd(); ++it)
+  {
+    if (it->second<start)
+      keptEntries << *it;
+    else if (it->second>end)
+      keptEntries << Entry(it->first, it->second-count);
+  }
+  m_entries = keptEntries;
+}
+
+/**
+ * @brief Removes markers identified by their indices
+ * @param markerIndices Indices of the markers, sorted in ascending order
+ */
+void MarkerIndex::removeMarkers(const QList<int>& markerIndices)
+{
+  QVector<Entry> keptEntries;
+  keptEntries.reserve(m_entries.size());
+  for (QVector<Entry>::const_iterator it = m_entries.constBegin(); it!=m_entries.constEnd(); ++it)
+  {
+    QList<int>::const_iterator removed = std::lower_bound(markerIndices.constBegin(), markerIndices.constEnd(), it->second);
+    if ((removed!=markerIndices.constEnd())&&(*removed==it->second))
+      continue;
+    
+    keptEntries << Entry(it->first, it->second-int(removed-markerIndices.constBegin()));
+  }
+  m_entries = keptEntries;
+}
+
+/**
+ * @brief Returns the markers inside a rectangle
+ *
+ * The rectangle is covered with a few cells of a suitable level, each cell
+ * is a range of the Z-order curve. Markers close to the rectangle may be
+ * returned as well.
+ *
+ * @param box Rectangle of latitudes and longitudes
+ * @return Indices of the markers, sorted in ascending order
+ */
+QVector<int> MarkerIndex::markersIn(const LatLonBox& box) const
+{
+  // about eight cells across the larger side of the rectangle:
+  const qreal lonSpan = (box.west<=box.east) ? box.east-box.west : box.east-box.west+360;
+  const qreal span = std::max(lonSpan, box.north-box.south);
+  int level = 0;
+  while ((level<MarkerHierarchyLevels)&&(360.0/(1<<(level+1))*8>=span))
+  {
+    ++level;
+  }
+  
+  int rowStart, rowEnd;
+  QList<QPair<int, int> > columnRanges;
+  latLonBoxCells(box, level, &rowStart, &rowEnd, &columnRanges);
+  
+  const int shift = 2*(MarkerHierarchyLevels-level);
+  QVector<int> result;
+  for (int row=rowStart; row<=rowEnd; ++row)
+  {
+    for (QList<QPair<int, int> >::const_iterator range = columnRanges.constBegin(); range!=columnRanges.constEnd(); ++range)
+    {
+      for (int column=range->first; column<=range->second; ++column)
+      {
+        const quint64 firstCode = (spreadBits(column) | (spreadBits(row)<<1))<<shift;
+        const quint64 lastCode = firstCode + ((Q_UINT64_C(1)<<shift)-1);
+        QVector<Entry>::const_iterator it = std::lower_bound(m_entries.constBegin(), m_entries.constEnd(), Entry(firstCode, 0), MarkerIndexEntryLessThan);
+        for (; (it!=m_entries.constEnd())&&(it->first<=lastCode); ++it)
+        {
+          result << it->second;
+        }
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+/**
+ * @brief The markers grouped into cells of a latitude/longitude grid, for every level of detail
+ *
+ * Level n divides the 360 degrees of longitude into 2^n cells, and the latitudes
+ * into cells of the same size. The markers are sorted along a Z-order curve of
+ * the finest level, so that the markers of every cell on every level form a
+ * contiguous range of order(). The hierarchy is built once for a set of markers,
+ * a view then only has to look at the cells of one level inside the viewport.
+ *
+ * Only the levels which group at least two markers per cell on average are kept,
+ * more detailed views have to use the markers themselves.
+ */
+class MarkerHierarchy
+{
+  public:
+    /**
+     * @brief The markers in one cell of a level
+     */
+    struct Cell
+    {
+      //! latitude index in the upper 32 bits, longitude index in the lower 32 bits
+      quint64 key;
+      //! position of the first marker of this cell in order()
+      int start;
+      //! number of markers in this cell
+      int count;
+      //! smallest index of the markers in this cell, stands for the position of the cell
+      int representative;
+
+      bool operator<(const Cell& other) const
+      {
+        return key<other.key;
+      }
+    };
+
+    typedef QVector<Cell> Level;
+
+    MarkerHierarchy()
+    : m_order(), m_levels(), m_complete(false)
+    {
+    }
+
+    void build(const MarkerClusterHolder::MarkerInfo::List& markers, const MarkerIndex& index);
+    int levelFor(const qreal radius) const;
+    Level cellsIn(const int level, const LatLonBox* const box) const;
+
+    /**
+     * @brief Returns the indices of all markers, sorted such that each cell is a contiguous range
+     */
+    const QVector<int>& order() const
+    {
+      return m_order;
+    }
+
+  private:
+    QVector<int> m_order;
+    QVector<Level> m_levels;
+    //! whether the most detailed level kept already separates all markers which the finest level separates
+    bool m_complete;
+
+  private:
+    Q_DISABLE_COPY(MarkerHierarchy)
+};
+
+/**
+ * @brief Builds the hierarchy for a set of markers
+ * @param markers The markers, the hierarchy refers to them by index
+ * @param index Spatial index over the markers, provides their order along the Z-order curve
+ */
+void MarkerHierarchy::build(const MarkerClusterHolder::MarkerInfo::List& markers, const MarkerIndex& index)
+{
+  m_order.clear();
+  m_levels.clear();
+  m_complete = false;
+  
+  const int markerCount = markers.count();
+  QVector<quint32> lonIndices(markerCount);
+  QVector<quint32> latIndices(markerCount);
+  for (int i=0; i<markerCount; ++i)
+  {
+    lonIndices[i] = markerHierarchyIndex(markers.at(i).lon()+180.0);
+    latIndices[i] = markerHierarchyIndex(markers.at(i).lat()+90.0);
+  }
+  const QVector<MarkerIndex::Entry>& codes = index.entries();
+  
+  m_order.reserve(markerCount);
+  for (int i=0; i<markerCount; ++i)
+  {
+    m_order << codes.at(i).second;
+  }
+  
+  // count the cells on every level, a cell of level n is a run of codes with the same upper 2*n bits:
+  QVector<int> cellCounts(MarkerHierarchyLevels+1, 0);
+  for (int i=0; i<markerCount; ++i)
+  {
+    for (int level=MarkerHierarchyLevels; level>=0; --level)
+    {
+      const int shift = 2*(MarkerHierarchyLevels-level);
+      if ((i>0)&&((codes.at(i).first>>shift)==(codes.at(i-1).first>>shift)))
+        break;
+      ++cellCounts[level];
+    }
+  }
+  
+  int levelCount = 0;
+  while ((levelCount<=MarkerHierarchyLevels)&&(cellCounts.at(levelCount)<=markerCount/2))
+  {
+    ++levelCount;
+    if (cellCounts.at(levelCount-1)==cellCounts.at(MarkerHierarchyLevels))
+    {
+      // all more detailed levels are the same as this one
+      m_complete = true;
+      break;
+    }
+  }
+  
+  m_levels.resize(levelCount);
+  for (int level=0; level<levelCount; ++level)
+  {
+    const int shift = 2*(MarkerHierarchyLevels-level);
+    Level& cells = m_levels[level];
+    cells.reserve(cellCounts.at(level));
+    for (int i=0; i<markerCount; ++i)
+    {
+      const int markerIndex = codes.at(i).second;
+      if ((i==0)||((codes.at(i).first>>shift)!=(codes.at(i-1).first>>shift)))
+      {
+        Cell cell;
+        cell.key = (quint64(latIndices.at(markerIndex)>>(shift/2))<<32) | (lonIndices.at(markerIndex)>>(shift/2));
+        cell.start = i;
+        cell.count = 0;
+        cell.representative = markerIndex;
+        cells << cell;
+      }
+      Cell& cell = cells.last();
+      ++cell.count;
+      cell.representative = std::min(cell.representative, markerIndex);
+    }
+    std::sort(cells.begin(), cells.end());
+  }
+}
+
+/**
+ * @brief Returns the level whose cells are about one pixel wide at the equator
+ * @param radius Radius of the globe in pixels, enlarged where the projection stretches the cells more
+ * @return The level, or -1 if the view is too detailed for the hierarchy
+ */
+int MarkerHierarchy::levelFor(const qreal radius) const
+{
+  int level = 0;
+  while ((level<=MarkerHierarchyLevels)&&(qreal(1<<level)<2*M_PI*radius))
+  {
+    ++level;
+  }
+  
+  if (level<m_levels.size())
+    return level;
+  
+  if (m_complete&&(level<=MarkerHierarchyLevels))
+    return m_levels.size()-1;
+  
+  return -1;
+}
+
+/**
+ * @brief Returns the cells of a level which are inside a rectangle
+ *
+ * The cells are found row by row, one binary search per row and range of longitudes.
+ *
+ * @param level The level
+ * @param box Rectangle of latitudes and longitudes, all cells are returned if it is null
+ * @return The cells inside the rectangle
+ */
+MarkerHierarchy::Level MarkerHierarchy::cellsIn(const int level, const LatLonBox* const box) const
+{
+  const Level& cells = m_levels.at(level);
+  if (!box)
+    return cells;
+  
+  int rowStart, rowEnd;
+  QList<QPair<int, int> > columnRanges;
+  latLonBoxCells(*box, level, &rowStart, &rowEnd, &columnRanges);
+  
+  Level result;
+  for (int row=rowStart; row<=rowEnd; ++row)
+  {
+    for (QList<QPair<int, int> >::const_iterator range = columnRanges.constBegin(); range!=columnRanges.constEnd(); ++range)
+    {
+      Cell first = Cell();
+      first.key = (quint64(row)<<32) | quint64(range->first);
+      const quint64 lastKey = (quint64(row)<<32) | quint64(range->second);
+      for (Level::const_iterator it = std::lower_bound(cells.constBegin(), cells.constEnd(), first); (it!=cells.constEnd())&&(it->key<=lastKey); ++it)
+      {
+        result << *it;
+      }
+    }
+  }
+  return result;
+}
+
 class MarkerClusterHolderPrivate
 {
   public:
     Marble::MarbleWidget* marbleWidget;
     QList<MarkerClusterHolder::ClusterInfo> clusters;
     QList<MarkerClusterHolder::MarkerInfo> markers;
+    MarkerIndex markerIndex;
+    MarkerHierarchy markerHierarchy;
+    MarkerProjection markerProjection;
     int lastZoom;
     qreal lastCenterLatitude;
     qreal lastCenterLongitude;
@@ -81,6 +588,9 @@ class MarkerClusterHolderPrivate
     : marbleWidget(parameterMarbleWidget),
       clusters(),
       markers(),
+      markerIndex(),
+      markerHierarchy(),
+      markerProjection(),
       lastZoom(-1),
       lastCenterLatitude(marbleWidget->centerLatitude()),
       lastCenterLongitude(marbleWidget->centerLongitude()),
@@ -163,6 +673,7 @@ MarkerClusterHolder::~MarkerClusterHolder()
  */
 void MarkerClusterHolder::addMarker(const MarkerInfo& marker)
 {
+  d->markerIndex.insertMarkers(d->markers.count(), MarkerInfo::List()<<marker);
   d->markers<<marker;
   d->markerCountDirty = true;
   redrawIfNecessary();
@@ -174,53 +685,133 @@ void MarkerClusterHolder::addMarker(const MarkerInfo& marker)
  */
 void MarkerClusterHolder::addMarkers(const QList<MarkerInfo>& markerList)
 {
+  d->markerIndex.insertMarkers(d->markers.count(), markerList);
   d->markers<<markerList;
   d->markerCountDirty = true;
   redrawIfNecessary();
 }
 
 /**
- * @brief Removes a range of markers
- * @param start Start index
- * @param end End index (inclusive!)
+ * @brief Inserts a list of markers in front of a given index
+ * @param index Index of the marker in front of which the markers are inserted
+ * @param markerList List of markers to be inserted
  */
-void MarkerClusterHolder::removeMarkers(const int start, const int end)
+void MarkerClusterHolder::insertMarkers(const int index, const QList<MarkerInfo>& markerList)
 {
-  for (int i = end; i>=start; --i)
+  d->markerIndex.insertMarkers(std::min(index, d->markers.count()), markerList);
+  if (index>=d->markers.count())
+  {
+    d->markers<<markerList;
+  }
+  else
   {
-    d->markers.removeAt(i);
+    // QList can only insert single items, build the new list in one pass instead:
+    MarkerInfo::List newMarkers = d->markers.mid(0, index);
+    newMarkers<<markerList<<d->markers.mid(index);
+    d->markers = newMarkers;
   }
   d->markerCountDirty = true;
   redrawIfNecessary();
 }
 
 /**
- * @brief Removes a list of markers identitifed by their indices
+ * @brief Replaces all markers
  *
- * Note that the indices have to be sorted in ascending order
+ * The selection and solo states are taken from the new markers.
  *
- * @param markerIndices List of indices of markers to be remove
+ * @param markerList List of the new markers
  */
-void MarkerClusterHolder::removeMarkers(const QIntList& markerIndices)
+void MarkerClusterHolder::setMarkers(const QList<MarkerInfo>& markerList)
+{
+  d->clusters.clear();
+  d->markers = markerList;
+  d->markerIndex.setMarkers(markerList);
+  d->markerCountDirty = true;
+  d->clusterStateDirty = true;
+  redrawIfNecessary();
+}
+
+/**
+ * @brief Moves a range of markers
+ *
+ * Same semantics as QAbstractItemModel::rowsMoved.
+ *
+ * @param start Start index
+ * @param end End index (inclusive!)
+ * @param destination Index of the marker in front of which the range is moved, counted before the move
+ */
+void MarkerClusterHolder::moveMarkers(const int start, const int end, const int destination)
 {
-  for (int i = markerIndices.size()-1; i>=0; --i)
+  if ((destination>=start)&&(destination<=end+1))
+    return;
+
+  d->markerIndex.moveMarkers(start, end, destination);
+  MarkerInfo::List::iterator first = d->markers.begin()+start;
+  MarkerInfo::List::iterator last = d->markers.begin()+end+1;
+  MarkerInfo::List::iterator target = d->markers.begin()+destination;
+  if (destination<start)
+  {
+    std::rotate(target, first, last);
+  }
+  else
   {
-    d->markers.removeAt(markerIndices.at(i));
+    std::rotate(first, last, target);
   }
   d->markerCountDirty = true;
   redrawIfNecessary();
 }
 
 /**
- * @brief Removes a list of markers
- * @param markerList List of markers to be remove
+ * @brief Removes a range of markers
+ * @param start Start index
+ * @param end End index (inclusive!)
  */
-void MarkerClusterHolder::removeMarkers(const QList<MarkerInfo>& markerList)
+void MarkerClusterHolder::removeMarkers(const int start, const int end)
 {
-  MarkerInfo::List markersToDelete = markerList;
-  int i = 0;
-  while ((i<d->markers.count())&&!markersToDelete.isEmpty())
-  {
+  d->markerIndex.removeMarkers(start, end);
+  d->markers.erase(d->markers.begin()+start, d->markers.begin()+end+1);
+  d->markerCountDirty = true;
+  redrawIfNecessary();
+}
+
+/**
+ * @brief Removes a list of markers identitifed by their indices
+ *
+ * Note that the indices have to be sorted in ascending order. The remaining
+ * markers are compacted in one pass.
+ *
+ * @param markerIndices List of indices of markers to be remove
+ */
+void MarkerClusterHolder::removeMarkers(const QIntList& markerIndices)
+{
+  MarkerInfo::List keptMarkers;
+  QIntList::const_iterator removed = markerIndices.constBegin();
+  for (int i = 0; i<d->markers.count(); ++i)
+  {
+    if ((removed!=markerIndices.constEnd())&&(*removed==i))
+    {
+      ++removed;
+      continue;
+    }
+    keptMarkers << d->markers.at(i);
+  }
+  d->markers = keptMarkers;
+  d->markerIndex.removeMarkers(markerIndices);
+  d->markerCountDirty = true;
+  redrawIfNecessary();
+}
+
+/**
+ * @brief Removes a list of markers
+ * @param markerList List of markers to be remove
+ */
+void MarkerClusterHolder::removeMarkers(const QList<MarkerInfo>& markerList)
+{
+  MarkerInfo::List markersToDelete = markerList;
+  QIntList deletedIndices;
+  int i = 0;
+  while ((i<d->markers.count())&&!markersToDelete.isEmpty())
+  {
     bool deletedOne = false;
     for (int di = 0; di<markersToDelete.count(); ++di)
     {
@@ -228,6 +819,7 @@ void MarkerClusterHolder::removeMarkers(const QList<MarkerInfo>& markerList)
       {
         d->markers.removeAt(i);
         markersToDelete.removeAt(di);
+        deletedIndices << i+deletedIndices.count();
         deletedOne = true;
         break;
       }
@@ -237,6 +829,7 @@ void MarkerClusterHolder::removeMarkers(const QList<MarkerInfo>& markerList)
       ++i;
     }
   }
+  d->markerIndex.removeMarkers(deletedIndices);
   
   d->markerCountDirty = true;
   redrawIfNecessary();
@@ -363,191 +956,639 @@ void MarkerClusterHolder::ClusterInfo::getColorInfos(const bool haveAnySolo, QCo
 }
 
 /**
- * @brief Paints the clusters on MarbleWidget
+ * @brief Paints the clusters on MarbleWidget
+ *
+ * Call this function from a customPaint of a Marble::MarbleWidget subclass
+ * If you do not want to subclass Marble::MarbleWidget yourself, use
+ * MarbleSubClassWidget
+ *
+ * @param painter Painter on which the clusters should be painted
+ */
+void MarkerClusterHolder::paintOnMarble(Marble::GeoPainter* const painter)
+{
+// externaldraw plugin only supported on version 0.8 or higher
+#if MARBLE_VERSION >= 0x000800
+  if (!d->externalDrawPlugin)
+  {
+    paintOnMarbleInternal(painter);
+  }
+#else
+  paintOnMarbleInternal(painter);
+#endif // MARBLE_VERSION >= 0x000800
+}
+
+/**
+ * @brief Paints the clusters on MarbleWidget
+ *
+ * This function is called internally either from paintOnMarble or from
+ * the externaldraw-plugin, if found
+ *
+ * @param painter Painter on which the clusters should be painted
+ */
+void MarkerClusterHolder::paintOnMarbleInternal(Marble::GeoPainter* const painter)
+{
+  // reorder the clusters if necessary
+  reorderClusters();
+  
+  painter->save();
+  painter->autoMapQuality();
+  
+  // determine the color:
+  QPen labelPen;
+  QPen circlePen;
+  
+  // draw all clusters:
+  for (QList<ClusterInfo>::iterator it = d->clusters.begin(); it!=d->clusters.end(); ++it)
+  {
+    const ClusterInfo& cluster = *it;
+    
+    const int radius = ClusterRadius;// + cluster.markerCount()/10.0;
+    
+    int clusterX = cluster.pixelPos.x();
+    int clusterY = cluster.pixelPos.y();
+    
+    bool havePixmap = false;
+    QPixmap clusterPixmap;
+    // should we draw a pixmap instead?
+    if (d->clusterPixmapFunction)
+    {
+      const QSize maxPixmapSize = cluster.maxSize;
+            havePixmap = d->clusterPixmapFunction(cluster, &(d->markers), maxPixmapSize,
+                                   d->clusterPixmapFunctionData, &clusterPixmap);
+    }
+    
+    // determine the color:
+    QColor fillColor;
+    QColor strokeColor;
+    Qt::PenStyle strokeStyle;
+    QColor labelColor;
+    QString labelText;
+    
+        cluster.getColorInfos(d->haveAnySoloMarkers, &fillColor, &strokeColor,
+                              &strokeStyle, &labelText, &labelColor);
+    
+    if (havePixmap)
+    {
+      // is the cluster partially hidden?
+      if (d->haveAnySoloMarkers && (cluster.solo!=ClusterInfo::PartialAll) )
+      {
+        // TODO: is there a smarter way to add an alpha-channel?
+        // Qt documentation warns that this way is expensive...
+        QPixmap alphaPixmap(clusterPixmap.size());
+        alphaPixmap.fill(QColor::fromRgb(0x80,0x80,0x80));
+        clusterPixmap.setAlphaChannel(alphaPixmap);
+      }
+      
+      const int pixmapX = clusterX - clusterPixmap.width()/2;
+      const int pixmapY = clusterY - clusterPixmap.height()/2;
+      if (cluster.selected!=ClusterInfo::PartialNone)
+      {
+        circlePen.setColor(strokeColor);
+        circlePen.setStyle(strokeStyle);
+        circlePen.setWidth(2);
+        painter->setPen(circlePen);
+        // size of the rectangle is the size of the filled area, the border is drawn around it
+        painter->drawRect(pixmapX, pixmapY, clusterPixmap.width(), clusterPixmap.height());
+      }
+      painter->drawPixmap(pixmapX, pixmapY, clusterPixmap);
+      
+      // save the size of the pixmap back to the cluster, because it defines the bounding box:
+      it->lastSize = clusterPixmap.size();
+    }
+    else
+    {
+      circlePen.setColor(strokeColor);
+      circlePen.setStyle(strokeStyle);
+      circlePen.setWidth(2);
+      labelPen.setColor(labelColor);
+    
+      painter->setPen(circlePen);
+      painter->setBrush(QBrush(fillColor));
+      painter->drawEllipse(clusterX-radius, clusterY-radius, 2*radius, 2*radius);
+
+      painter->setPen(labelPen);
+            painter->drawText(QRect(clusterX-radius,clusterY-radius,2*radius,2*radius),
+                              Qt::AlignHCenter|Qt::AlignVCenter, labelText);
+      
+      // we used the default size of the cluster:
+      it->lastSize = ClusterDefaultSize;
+    }
+  }
+  
+  painter->restore();
+}
+
+/**
+ * @brief Clears all markers and clusters
+ */
+void MarkerClusterHolder::clear()
+{
+  d->clusters.clear();
+  d->markers.clear();
+  d->markerIndex.clear();
+  d->markerProjection.clear();
+  d->markerCountDirty = true;
+  d->haveAnySoloMarkers = false;
+  emit(signalSoloChanged());
+  emit(signalSelectionChanged());
+  redrawIfNecessary();
+}
+
+/**
+ * @brief Causes the map to be redrawn if the number of markers has changed and autoRedrawOnMarkerAdd is set
+ * @param force Force a redraw
+ */
+void MarkerClusterHolder::redrawIfNecessary(const bool force)
+{
+  if ( ( (d->clusterStateDirty||d->markerCountDirty) && d->autoRedrawOnMarkerAdd ) || force )
+  {
+    d->marbleWidget->update();
+  }
+}
+
+/**
+ * @brief Returns whether the map should be updated when a marker is added/deleted
+ * @return Whether the map is updated automatically
+ */
+bool MarkerClusterHolder::autoRedrawOnMarkerAdd() const
+{
+  return d->autoRedrawOnMarkerAdd;
+}
+
+/**
+ * @brief Set whether the map should be updated when a marker is added/deleted
+ * @param doRedraw Whether the map is redrawn on changes
+ */
+void MarkerClusterHolder::setAutoRedrowOnMarkerAdd(const bool doRedraw)
+{
+  d->autoRedrawOnMarkerAdd = doRedraw; 
+}
+
+/**
+ * @brief Reorders the markers into clusters
+ */
+void MarkerClusterHolder::reorderClusters()
+{
+  reorderClustersPixelGrid();
+}
+
+/**
+ * @brief Returns markers which are visible on the map
+ *
+ * The clusters only hold the markers on the map, so no marker has to be projected.
+ * The markers are taken from the clusters in turns, so that every cluster is
+ * represented if there are more markers than requested.
+ *
+ * @param maxCount Maximum number of markers to return
+ * @return Indices of at most maxCount visible markers
+ */
+MarkerClusterHolder::QIntList MarkerClusterHolder::visibleMarkers(const int maxCount)
+{
+  // the clusters may be older than the markers or the map:
+  reorderClusters();
+  
+  QIntList markerIndices;
+  for (int turn=0; markerIndices.count()<maxCount; ++turn)
+  {
+    bool haveMoreMarkers = false;
+    for (QList<ClusterInfo>::const_iterator it = d->clusters.constBegin(); (it!=d->clusters.constEnd())&&(markerIndices.count()<maxCount); ++it)
+    {
+      if (turn<it->markerCount())
+      {
+        markerIndices << it->markerIndices.at(turn);
+        haveMoreMarkers = true;
+      }
+    }
+    
+    if (!haveMoreMarkers)
+      break;
+  }
+  
+  return markerIndices;
+}
+
+/**
+ * @brief Helper function, returns the square of the distance between two points
+ *
+ * @param a Point a
+ * @param b Point b
+ * @return Square of the distance between a and b
+ */
+inline int QPointSquareDistance(const QPoint& a, const QPoint& b)
+{
+  return (a.x()-b.x())*(a.x()-b.x()) + (a.y()-b.y())*(a.y()-b.y());
+}
+
+/**
+ * @brief Markers which are projected together
+ *
+ * Either a single marker, or the markers of a cell of the MarkerHierarchy,
+ * which are placed at the position of the representative marker.
+ */
+struct PixelGridSource
+{
+  //! index of the marker whose position is used
+  int marker;
+  //! position of the first marker in MarkerHierarchy::order(), -1 for a single marker
+  int start;
+  //! number of markers
+  int count;
+};
+
+typedef QVector<PixelGridSource> PixelGridSources;
+
+/**
+ * @brief The markers on one pixel of the screen
+ *
+ * Only the occupied pixels get a cell. The sources of all cells are stored as
+ * (pixel index, source index) pairs in one array sorted by pixel, each cell
+ * refers to its part of that array.
+ */
+struct PixelGridCell
+{
+  //! index of the pixel, x + y*width
+  int index;
+  //! position of the first source of this cell in the array of pairs
+  int start;
+  //! number of sources in this cell
+  int size;
+  //! number of markers in this cell, 0 once they were moved into a cluster
+  int count;
+  //! whether the cell is too close to a cluster to become a cluster itself
+  bool tooClose;
+};
+
+typedef QVector<PixelGridCell> PixelGrid;
+typedef QVector<QPair<int, int> > PixelGridMarkers;
+
+/**
+ * @brief Helper function for finding the cell of a pixel in a sorted PixelGrid
+ */
+inline bool PixelGridCellLessThan(const PixelGridCell& cell, const int index)
+{
+  return cell.index<index;
+}
+
+/**
+ * @brief Helper function, takes the markers out of a cell
+ *
+ * @param cell Cell whose markers are taken, is empty afterwards
+ * @param gridMarkers The array of pairs the cell refers to
+ * @param sources The sources the pairs refer to
+ * @param order Marker indices the sources from the MarkerHierarchy refer to
+ * @return Indices of the markers in the cell
+ */
+static QList<int> takePixelGridMarkers(PixelGridCell* const cell, const PixelGridMarkers& gridMarkers,
+                                       const PixelGridSources& sources, const QVector<int>& order)
+{
+  QList<int> markerIndices;
+  for (int i=cell->start; i<cell->start+cell->size; ++i)
+  {
+    const PixelGridSource& source = sources.at(gridMarkers.at(i).second);
+    if (source.start<0)
+    {
+      markerIndices << source.marker;
+      continue;
+    }
+    
+    for (int j=source.start; j<source.start+source.count; ++j)
+    {
+      markerIndices << order.at(j);
+    }
+  }
+  cell->count = 0;
+  return markerIndices;
+}
+
+/**
+ * @brief Helper function, collects the occupied cells within a rectangle of pixels
+ *
+ * The cells are found row by row, one binary search per row.
+ *
+ * @param pixelGrid The occupied cells, sorted by pixel
+ * @param gridWidth Width of the grid
+ * @param area Rectangle of pixels, has to be inside the grid
+ * @return Positions of the cells in pixelGrid which still contain markers
+ */
+static QVector<int> pixelGridCellsIn(const PixelGrid& pixelGrid, const int gridWidth, const QRect& area)
+{
+  QVector<int> cells;
+  for (int y=area.top(); y<=area.bottom(); ++y)
+  {
+    PixelGrid::const_iterator it = std::lower_bound(pixelGrid.constBegin(), pixelGrid.constEnd(), area.left()+y*gridWidth, PixelGridCellLessThan);
+    for (; (it!=pixelGrid.constEnd())&&(it->index<=area.right()+y*gridWidth); ++it)
+    {
+      if (it->count>0)
+        cells << it-pixelGrid.constBegin();
+    }
+  }
+  return cells;
+}
+
+/**
+ * @brief Helper function, returns whether a point is visible on the map
+ */
+static bool isOnScreen(Marble::MarbleWidget* const marbleWidget, const qreal lon, const qreal lat)
+{
+#if MARBLE_VERSION >= 0x000800
+  qreal x, y;
+#else
+  int x, y;
+#endif
+  return marbleWidget->screenCoordinates(lon, lat, x, y);
+}
+
+/**
+ * @brief Helper function, returns whether a point is visible on the map and where
+ */
+static bool screenPosition(Marble::MarbleWidget* const marbleWidget, const qreal lon, const qreal lat, double* const x, double* const y)
+{
+#if MARBLE_VERSION >= 0x000800
+  qreal screenX, screenY;
+#else
+  int screenX, screenY;
+#endif
+  if (!marbleWidget->screenCoordinates(lon, lat, screenX, screenY))
+    return false;
+  *x = screenX;
+  *y = screenY;
+  return true;
+}
+
+/**
+ * @brief Helper function, describes the view of the map for MarkerProjection
+ * @return false if MarkerProjection does not support the projection of the map
+ */
+static bool markerProjectionView(Marble::MarbleWidget* const marbleWidget, MarkerProjection::View* const view)
+{
+  switch (marbleWidget->projection())
+  {
+    case Marble::Spherical:
+      view->projection = MarkerProjection::Spherical;
+      break;
+    case Marble::Equirectangular:
+      view->projection = MarkerProjection::Equirectangular;
+      break;
+#if MARBLE_VERSION >= 0x000800
+    case Marble::Mercator:
+      view->projection = MarkerProjection::Mercator;
+      break;
+#endif // MARBLE_VERSION >= 0x000800
+    default:
+      return false;
+  }
+  
+  const QSize mapSize = marbleWidget->map()->size();
+  view->centerLongitude = marbleWidget->centerLongitude();
+  view->centerLatitude = marbleWidget->centerLatitude();
+  view->radius = marbleWidget->radius();
+  view->width = mapSize.width();
+  view->height = mapSize.height();
+  return true;
+}
+
+#ifndef QT_NO_DEBUG
+/**
+ * @brief Helper function, returns whether a point is within a pixel of the edge of the map
+ *
+ * The edge is the border of the map, and on the globe also its horizon.
+ */
+static bool nearMapEdge(const MarkerProjection::View& view, const double x, const double y)
+{
+  if ((x<1.0)||(y<1.0)||(x>view.width-1.0)||(y>view.height-1.0))
+    return true;
+  
+  if (view.projection!=MarkerProjection::Spherical)
+    return false;
+  
+  const double centerDistance = sqrt(pow(x-view.width/2.0, 2)+pow(y-view.height/2.0, 2));
+  return centerDistance>view.radius-1.0;
+}
+
+/**
+ * @brief Helper function, compares a sample of the batched projection with Marble
+ *
+ * Warns if a marker is more than a pixel away from where MarbleWidget::screenCoordinates
+ * puts it, or if the two disagree about whether it is visible. Points within a pixel of
+ * the edge of the map may end up on either side. The flat maps repeat the world every
+ * 4*radius pixels, so their x coordinates are compared modulo that width.
+ *
+ * @param marbleWidget The map
+ * @param view The view for which the markers were projected
+ * @param markerList All markers
+ * @param markers Indices of the projected markers
+ * @param count Number of projected markers
+ * @param x x coordinates from MarkerProjection::project
+ * @param y y coordinates from MarkerProjection::project
+ * @param visible Visibility from MarkerProjection::project
+ */
+static void checkMarkerProjection(Marble::MarbleWidget* const marbleWidget, const MarkerProjection::View& view,
+                                  const MarkerClusterHolder::MarkerInfo::List& markerList, const int* const markers,
+                                  const int count, const double* const x, const double* const y, const uchar* const visible)
+{
+  // about 32 markers, spread over all of them:
+  const int step = std::max(count/32, 1);
+  for (int i=0; i<count; i+=step)
+  {
+    const MarkerClusterHolder::MarkerInfo& marker = markerList.at(markers[i]);
+    double marbleX = 0, marbleY = 0;
+    const bool marbleVisible = screenPosition(marbleWidget, marker.lon(), marker.lat(), &marbleX, &marbleY);
+    if (!marbleVisible||!visible[i])
+    {
+      if ((marbleVisible!=bool(visible[i]))&&!nearMapEdge(view, marbleVisible ? marbleX : x[i], marbleVisible ? marbleY : y[i]))
+      {
+        kWarning(50003) << QString("marker %1 at %2,%3 is %4 by MarkerProjection, but not by Marble")
+                             .arg(markers[i]).arg(marker.lon()).arg(marker.lat()).arg(visible[i] ? "visible" : "hidden");
+      }
+      continue;
+    }
+    
+    double deltaX = x[i]-marbleX;
+    if (view.projection!=MarkerProjection::Spherical)
+    {
+      const double worldWidth = 4.0*view.radius;
+      deltaX -= worldWidth*floor(deltaX/worldWidth+0.5);
+    }
+    if ((qAbs(deltaX)>1.0)||(qAbs(y[i]-marbleY)>1.0))
+    {
+      kWarning(50003) << QString("marker %1 at %2,%3 is projected to %4,%5 by MarkerProjection, but to %6,%7 by Marble")
+                           .arg(markers[i]).arg(marker.lon()).arg(marker.lat()).arg(x[i]).arg(y[i]).arg(marbleX).arg(marbleY);
+    }
+  }
+}
+#endif // QT_NO_DEBUG
+
+/**
+ * @brief Helper function, returns the radius for which MarkerHierarchy::levelFor picks the level
  *
- * Call this function from a customPaint of a Marble::MarbleWidget subclass
- * If you do not want to subclass Marble::MarbleWidget yourself, use
- * MarbleSubClassWidget
+ * The cells of the hierarchy are as high as they are wide in degrees, so they are square
+ * on the equator. Mercator stretches them vertically by 1/cos(latitude), so the level has
+ * to be picked for the largest latitude in the viewport.
  *
- * @param painter Painter on which the clusters should be painted
+ * @param marbleWidget The map
+ * @param box The latitudes and longitudes visible on the map, or 0 if they are not known
+ * @return The radius of the globe in pixels, enlarged by the vertical stretch of the projection
  */
-void MarkerClusterHolder::paintOnMarble(Marble::GeoPainter* const painter)
+static qreal hierarchyRadius(Marble::MarbleWidget* const marbleWidget, const LatLonBox* const box)
 {
-// externaldraw plugin only supported on version 0.8 or higher
+  const qreal radius = marbleWidget->radius();
 #if MARBLE_VERSION >= 0x000800
-  if (!d->externalDrawPlugin)
+  if (marbleWidget->projection()==Marble::Mercator)
   {
-    paintOnMarbleInternal(painter);
+    const qreal mercatorMaximumLatitude = MarkerProjection::MercatorMaximumLatitude;
+    const qreal maxLatitude = box ? std::min(std::max(qAbs(box->south), qAbs(box->north)), mercatorMaximumLatitude) : mercatorMaximumLatitude;
+    return radius/cos(maxLatitude*M_PI/180.0);
   }
 #else
-  paintOnMarbleInternal(painter);
+  Q_UNUSED(box)
 #endif // MARBLE_VERSION >= 0x000800
+  return radius;
 }
 
 /**
- * @brief Paints the clusters on MarbleWidget
+ * @brief Helper function, determines the latitudes and longitudes visible on the map
  *
- * This function is called internally either from paintOnMarble or from
- * the externaldraw-plugin, if found
+ * The border of the map is sampled. The rectangle is enlarged by the largest step
+ * between two samples, the border may bulge out between them.
  *
- * @param painter Painter on which the clusters should be painted
+ * @param marbleWidget The map
+ * @param box The rectangle is stored here
+ * @return false if the border of the map is not completely on the earth,
+ *         in which case no useful rectangle can be given
  */
-void MarkerClusterHolder::paintOnMarbleInternal(Marble::GeoPainter* const painter)
+static bool viewportLatLonBox(Marble::MarbleWidget* const marbleWidget, LatLonBox* const box)
 {
-  // reorder the clusters if necessary
-  reorderClusters();
-  
-  painter->save();
-  painter->autoMapQuality();
+  const QSize mapSize = marbleWidget->map()->size();
+  const int width = mapSize.width()-1;
+  const int height = mapSize.height()-1;
   
-  // determine the color:
-  QPen labelPen;
-  QPen circlePen;
+  // walk around the border clockwise:
+  const int steps = 16;
+  QVector<QPoint> border;
+  for (int i=0; i<steps; ++i)
+    border << QPoint(i*width/steps, 0);
+  for (int i=0; i<steps; ++i)
+    border << QPoint(width, i*height/steps);
+  for (int i=0; i<steps; ++i)
+    border << QPoint(width-i*width/steps, height);
+  for (int i=0; i<steps; ++i)
+    border << QPoint(0, height-i*height/steps);
+  border << border.first();
   
-  // draw all clusters:
-  for (QList<ClusterInfo>::iterator it = d->clusters.begin(); it!=d->clusters.end(); ++it)
+  qreal lonMin = 0, lonMax = 0, latMin = 0, latMax = 0;
+  qreal previousLon = 0, unwrappedLon = 0;
+  qreal lonStep = 0, latStep = 0, previousLat = 0;
+  for (int i=0; i<border.size(); ++i)
   {
-    const ClusterInfo& cluster = *it;
-    
-    const int radius = ClusterRadius;// + cluster.markerCount()/10.0;
-    
-    int clusterX = cluster.pixelPos.x();
-    int clusterY = cluster.pixelPos.y();
-    
-    bool havePixmap = false;
-    QPixmap clusterPixmap;
-    // should we draw a pixmap instead?
-    if (d->clusterPixmapFunction)
-    {
-      const QSize maxPixmapSize = cluster.maxSize;
-            havePixmap = d->clusterPixmapFunction(cluster, &(d->markers), maxPixmapSize,
-                                   d->clusterPixmapFunctionData, &clusterPixmap);
-    }
-    
-    // determine the color:
-    QColor fillColor;
-    QColor strokeColor;
-    Qt::PenStyle strokeStyle;
-    QColor labelColor;
-    QString labelText;
-    
-        cluster.getColorInfos(d->haveAnySoloMarkers, &fillColor, &strokeColor,
-                              &strokeStyle, &labelText, &labelColor);
+    qreal lon, lat;
+    if (!marbleWidget->geoCoordinates(border.at(i).x(), border.at(i).y(), lon, lat, Marble::GeoDataCoordinates::Degree))
+      return false;
     
-    if (havePixmap)
+    if (i==0)
     {
-      // is the cluster partially hidden?
-      if (d->haveAnySoloMarkers && (cluster.solo!=ClusterInfo::PartialAll) )
-      {
-        // TODO: is there a smarter way to add an alpha-channel?
-        // Qt documentation warns that this way is expensive...
-        QPixmap alphaPixmap(clusterPixmap.size());
-        alphaPixmap.fill(QColor::fromRgb(0x80,0x80,0x80));
-        clusterPixmap.setAlphaChannel(alphaPixmap);
-      }
-      
-      const int pixmapX = clusterX - clusterPixmap.width()/2;
-      const int pixmapY = clusterY - clusterPixmap.height()/2;
-      if (cluster.selected!=ClusterInfo::PartialNone)
-      {
-        circlePen.setColor(strokeColor);
-        circlePen.setStyle(strokeStyle);
-        circlePen.setWidth(2);
-        painter->setPen(circlePen);
-        // size of the rectangle is the size of the filled area, the border is drawn around it
-        painter->drawRect(pixmapX, pixmapY, clusterPixmap.width(), clusterPixmap.height());
-      }
-      painter->drawPixmap(pixmapX, pixmapY, clusterPixmap);
-      
-      // save the size of the pixmap back to the cluster, because it defines the bounding box:
-      it->lastSize = clusterPixmap.size();
+      lonMin = lonMax = unwrappedLon = lon;
+      latMin = latMax = lat;
     }
     else
     {
-      circlePen.setColor(strokeColor);
-      circlePen.setStyle(strokeStyle);
-      circlePen.setWidth(2);
-      labelPen.setColor(labelColor);
-    
-      painter->setPen(circlePen);
-      painter->setBrush(QBrush(fillColor));
-      painter->drawEllipse(clusterX-radius, clusterY-radius, 2*radius, 2*radius);
-
-      painter->setPen(labelPen);
-            painter->drawText(QRect(clusterX-radius,clusterY-radius,2*radius,2*radius),
-                              Qt::AlignHCenter|Qt::AlignVCenter, labelText);
+      // follow the border across the date line:
+      qreal deltaLon = lon-previousLon;
+      if (deltaLon>180)
+        deltaLon -= 360;
+      else if (deltaLon<-180)
+        deltaLon += 360;
+      unwrappedLon += deltaLon;
       
-      // we used the default size of the cluster:
-      it->lastSize = ClusterDefaultSize;
+      lonMin = std::min(lonMin, unwrappedLon);
+      lonMax = std::max(lonMax, unwrappedLon);
+      latMin = std::min(latMin, lat);
+      latMax = std::max(latMax, lat);
+      lonStep = std::max(lonStep, qAbs(deltaLon));
+      latStep = std::max(latStep, qAbs(lat-previousLat));
     }
+    previousLon = lon;
+    previousLat = lat;
   }
   
-  painter->restore();
-}
-
-/**
- * @brief Clears all markers and clusters
- */
-void MarkerClusterHolder::clear()
-{
-  d->clusters.clear();
-  d->markers.clear();
-  d->markerCountDirty = true;
-  d->haveAnySoloMarkers = false;
-  emit(signalSoloChanged());
-  emit(signalSelectionChanged());
-  redrawIfNecessary();
-}
-
-/**
- * @brief Causes the map to be redrawn if the number of markers has changed and autoRedrawOnMarkerAdd is set
- * @param force Force a redraw
- */
-void MarkerClusterHolder::redrawIfNecessary(const bool force)
-{
-  if ( ( (d->clusterStateDirty||d->markerCountDirty) && d->autoRedrawOnMarkerAdd ) || force )
+  lonMin -= lonStep;
+  lonMax += lonStep;
+  box->south = std::max(latMin-latStep, qreal(-90));
+  box->north = std::min(latMax+latStep, qreal(90));
+  
+  // all longitudes meet at a pole inside the border:
+  const bool northPole = isOnScreen(marbleWidget, 0, 90);
+  const bool southPole = isOnScreen(marbleWidget, 0, -90);
+  if (northPole)
+    box->north = 90;
+  if (southPole)
+    box->south = -90;
+  
+  if (northPole||southPole||(lonMax-lonMin>=360))
   {
-    d->marbleWidget->update();
+    box->west = -180;
+    box->east = 180;
   }
+  else
+  {
+    box->west = lonMin-360*floor((lonMin+180)/360);
+    box->east = lonMax-360*floor((lonMax+180)/360);
+  }
+  
+  return true;
 }
 
 /**
- * @brief Returns whether the map should be updated when a marker is added/deleted
- * @return Whether the map is updated automatically
+ * @brief Maximum of the marker counts over a range of cells
+ *
+ * A segment tree over the cells of a PixelGrid, used to find the fullest
+ * cell in front of a given cell in O(log n).
  */
-bool MarkerClusterHolder::autoRedrawOnMarkerAdd() const
+class PixelGridMaximumTree
 {
-  return d->autoRedrawOnMarkerAdd;
-}
+  public:
+    PixelGridMaximumTree(const int size)
+    : m_size(1), m_values()
+    {
+      while (m_size<size)
+        m_size*=2;
+      m_values.fill(0, 2*m_size);
+    }
 
-/**
- * @brief Set whether the map should be updated when a marker is added/deleted
- * @param doRedraw Whether the map is redrawn on changes
- */
-void MarkerClusterHolder::setAutoRedrowOnMarkerAdd(const bool doRedraw)
-{
-  d->autoRedrawOnMarkerAdd = doRedraw; 
-}
+    /**
+     * @brief Sets the value of a cell
+     * @param position Position of the cell in the PixelGrid
+     * @param value The new value
+     */
+    void set(const int position, const int value)
+    {
+      int node = position+m_size;
+      m_values[node] = value;
+      for (node/=2; node>0; node/=2)
+      {
+        m_values[node] = std::max(m_values.at(2*node), m_values.at(2*node+1));
+      }
+    }
 
-/**
- * @brief Reorders the markers into clusters
- */
-void MarkerClusterHolder::reorderClusters()
-{
-  reorderClustersPixelGrid();
-}
+    /**
+     * @brief Returns the maximum of the values of the cells from first up to, but not including, last
+     */
+    int maximum(const int first, const int last) const
+    {
+      int result = 0;
+      for (int left = first+m_size, right = last+m_size; left<right; left/=2, right/=2)
+      {
+        if (left&1)
+          result = std::max(result, m_values.at(left++));
+        if (right&1)
+          result = std::max(result, m_values.at(--right));
+      }
+      return result;
+    }
 
-/**
- * @brief Helper function, returns the square of the distance between two points
- *
- * @param a Point a
- * @param b Point b
- * @return Square of the distance between a and b
- */
-inline int QPointSquareDistance(const QPoint& a, const QPoint& b)
-{
-  return (a.x()-b.x())*(a.x()-b.x()) + (a.y()-b.y())*(a.y()-b.y());
-}
+  private:
+    int m_size;
+    QVector<int> m_values;
+};
 
 /**
  * @brief Reorder the clusters if the map has changed
@@ -570,35 +1611,107 @@ void MarkerClusterHolder::reorderClustersPixelGrid()
   d->lastZoom = newZoom;
   d->lastCenterLatitude = newCenterLatitude;
   d->lastCenterLongitude = newCenterLongitude;
+  if (d->markerCountDirty)
+  {
+    // the markers have changed, group them again:
+    d->markerHierarchy.build(d->markers, d->markerIndex);
+    
+    QVector<double> longitudes(d->markers.count());
+    QVector<double> latitudes(d->markers.count());
+    for (int i = 0; i<d->markers.count(); ++i)
+    {
+      longitudes[i] = d->markers.at(i).lon();
+      latitudes[i] = d->markers.at(i).lat();
+    }
+    d->markerProjection.setCoordinates(longitudes.constData(), latitudes.constData(), d->markers.count());
+  }
   d->markerCountDirty = false;
   
   // clear all clusters:
   d->clusters.clear();
   
-  const int gridSize = ClusterGridSizeScreen;
+  const int gridSize = MarkerClusterHolder::ClusterGridSizeScreen;
   
-  // add all markers to a grid:
+  // Project the markers, sorted by their pixel. Only the occupied pixels are stored, the
+  // cost depends on the number of markers, not on the size of the map. If the view is not
+  // too detailed, the cells of the hierarchy inside the viewport are projected instead,
+  // they are at most about one pixel wide and high:
   const QSize mapSize = d->marbleWidget->map()->size();
   const int gridWidth = mapSize.width();
   const int gridHeight = mapSize.height();
-  QVector<QIntList> pixelGrid(gridWidth*gridHeight, QIntList());
+  const QVector<int>& order = d->markerHierarchy.order();
+  PixelGridSources sources;
+  LatLonBox viewportBox;
+  const bool haveViewportBox = viewportLatLonBox(d->marbleWidget, &viewportBox);
+  const int hierarchyLevel = d->markerHierarchy.levelFor(hierarchyRadius(d->marbleWidget, haveViewportBox ? &viewportBox : 0));
+  if (hierarchyLevel>=0)
+  {
+    const MarkerHierarchy::Level cells = d->markerHierarchy.cellsIn(hierarchyLevel, haveViewportBox ? &viewportBox : 0);
+    sources.reserve(cells.count());
+    for (MarkerHierarchy::Level::const_iterator it = cells.constBegin(); it!=cells.constEnd(); ++it)
+    {
+      const PixelGridSource source = { it->representative, it->start, it->count };
+      sources << source;
+    }
+  }
+  else if (haveViewportBox)
+  {
+    // only the markers inside the viewport have to be projected:
+    const QVector<int> viewportMarkers = d->markerIndex.markersIn(viewportBox);
+    sources.reserve(viewportMarkers.count());
+    for (QVector<int>::const_iterator it = viewportMarkers.constBegin(); it!=viewportMarkers.constEnd(); ++it)
+    {
+      const PixelGridSource source = { *it, -1, 1 };
+      sources << source;
+    }
+  }
+  else
+  {
+    sources.reserve(d->markers.count());
+    for (int i = 0; i<d->markers.count(); ++i)
+    {
+      const PixelGridSource source = { i, -1, 1 };
+      sources << source;
+    }
+  }
+  
+  // get the screen coordinates and check whether the markers are on screen, all
+  // sources at once if the projection of the map is supported:
+  const int sourceCount = sources.count();
+  QVector<double> sourceX(sourceCount);
+  QVector<double> sourceY(sourceCount);
+  QVector<uchar> sourceVisible(sourceCount);
+  MarkerProjection::View view;
+  if (markerProjectionView(d->marbleWidget, &view))
+  {
+    QVector<int> sourceMarkers(sourceCount);
+    for (int i = 0; i<sourceCount; ++i)
+      sourceMarkers[i] = sources.at(i).marker;
+    d->markerProjection.project(view, sourceMarkers.constData(), sourceCount, sourceX.data(), sourceY.data(), sourceVisible.data());
+#ifndef QT_NO_DEBUG
+    checkMarkerProjection(d->marbleWidget, view, d->markers, sourceMarkers.constData(), sourceCount,
+                          sourceX.constData(), sourceY.constData(), sourceVisible.constData());
+#endif // QT_NO_DEBUG
+  }
+  else
+  {
+    for (int i = 0; i<sourceCount; ++i)
+    {
+      const MarkerInfo& marker = d->markers.at(sources.at(i).marker);
+      sourceVisible[i] = screenPosition(d->marbleWidget, marker.lon(), marker.lat(), &sourceX[i], &sourceY[i]);
+    }
+  }
+  
+  PixelGridMarkers gridMarkers;
+  gridMarkers.reserve(sourceCount);
   QList<QPair<QPoint, QIntList> > leftOverList;
-  for (int i = 0; i<d->markers.count(); ++i)
+  for (int i = 0; i<sourceCount; ++i)
   {
-    const MarkerInfo& marker = d->markers.at(i);
-    
-    // get the screen coordinates and check whether the marker is on screen:
-    int markerX, markerY;
-#if MARBLE_VERSION >= 0x000800
-    qreal qrealMarkerX, qrealMarkerY;
-    if (!d->marbleWidget->screenCoordinates(marker.lon(), marker.lat(), qrealMarkerX, qrealMarkerY))
-      continue;
-    markerX = qrealMarkerX;
-    markerY = qrealMarkerY;
-#else
-    if (!d->marbleWidget->screenCoordinates(marker.lon(), marker.lat(), markerX, markerY))
+    if (!sourceVisible.at(i))
       continue;
-#endif
+    
+    int markerX = static_cast<int>(sourceX.at(i));
+    int markerY = static_cast<int>(sourceY.at(i));
 
     // make sure we are in the grid
     if (markerX<0)
@@ -611,108 +1724,153 @@ void MarkerClusterHolder::reorderClustersPixelGrid()
       markerY=gridHeight-1;
    
     // save the position of the marker:
-    pixelGrid[int(markerX)+int(markerY)*gridWidth]<<i;
+    gridMarkers << QPair<int, int>(markerX+markerY*gridWidth, i);
+  }
+  
+  // the sources of a pixel keep their order, because the pairs are compared by their index second:
+  std::sort(gridMarkers.begin(), gridMarkers.end());
+  
+  PixelGrid pixelGrid;
+  for (int i=0; i<gridMarkers.size(); ++i)
+  {
+    if (pixelGrid.isEmpty()||(pixelGrid.last().index!=gridMarkers.at(i).first))
+    {
+      PixelGridCell cell;
+      cell.index = gridMarkers.at(i).first;
+      cell.start = i;
+      cell.size = 0;
+      cell.count = 0;
+      cell.tooClose = false;
+      pixelGrid << cell;
+    }
+    ++pixelGrid.last().size;
+    pixelGrid.last().count += sources.at(gridMarkers.at(i).second).count;
   }
   
-  // TODO: cleanup this list every ... iterations
-  QIntList pixelGridIndices;
-  for (int i=0; i<gridWidth*gridHeight; ++i)
+  // The clusters are created greedily at the fullest cell which is not too close to an existing
+  // cluster, ties go to the cell which comes first on the screen. The counts of the cells never
+  // grow, so a list sorted once gives the candidates in that order:
+  QVector<QPair<int, int> > candidates;
+  candidates.reserve(pixelGrid.size());
+  PixelGridMaximumTree freeCellCounts(pixelGrid.size());
+  for (int i=0; i<pixelGrid.size(); ++i)
   {
-    if (!pixelGrid[i].isEmpty())
-      pixelGridIndices << i;
+    candidates << QPair<int, int>(-pixelGrid.at(i).count, i);
+    freeCellCounts.set(i, pixelGrid.at(i).count);
   }
+  std::sort(candidates.begin(), candidates.end());
   
-  // re-add the markers to clusters:
-  int lastTooCloseClusterIndex = 0;
+  // Cells which are too close to a cluster are moved into the leftover list once a cell
+  // in front of them is no fuller than they are. Until then, a new cluster may absorb them.
+  const int tooCloseRadius = MarkerClusterHolder::ClusterGridSizeScreen/2;
+  std::set<int> tooCloseCells;
+  QHash<int, QIntList> clusterBins;
+  const int clusterBinsPerRow = gridWidth/tooCloseRadius + 1;
+  int nextCandidate = 0;
   while (true)
   {
-    int markerMax(0), markerX(0), markerY(0), pixelGridMetaIndexMax = 0;
-    
-    for (int pixelGridMetaIndex = 0; pixelGridMetaIndex<pixelGridIndices.size(); ++pixelGridMetaIndex)
+    QVector<int> leftOverCells;
+    int bestCell = -1;
+    for (; nextCandidate<candidates.size(); ++nextCandidate)
     {
-      const int index = pixelGridIndices[pixelGridMetaIndex];
-      if (index<0)
+      const int cellIndex = candidates.at(nextCandidate).second;
+      const PixelGridCell& cell = pixelGrid.at(cellIndex);
+      if (cell.count==0)
         continue;
       
-      if (pixelGrid[index].isEmpty())
+      if (!cell.tooClose)
       {
-        pixelGridIndices[pixelGridMetaIndex] = -1;
-        continue;
+        bestCell = cellIndex;
+        ++nextCandidate;
+        break;
       }
       
-      const int x = index % gridWidth;
-      const int y = (index-x)/gridWidth;
-      const QPoint markerPosition(x, y);
-      
-      if (pixelGrid[index].size()>markerMax)
+      leftOverCells << cellIndex;
+      tooCloseCells.erase(cellIndex);
+    }
+    
+    // cells which are too close and come before the new cluster, but have more markers than all free cells in front of them:
+    int freeCellMax = 0;
+    int freeCellMaxEnd = 0;
+    for (std::set<int>::iterator it = tooCloseCells.begin(); (bestCell>=0)&&(it!=tooCloseCells.end())&&(*it<bestCell); )
+    {
+      freeCellMax = std::max(freeCellMax, freeCellCounts.maximum(freeCellMaxEnd, *it));
+      freeCellMaxEnd = *it;
+      if (pixelGrid.at(*it).count>freeCellMax)
       {
-        // only create a cluster here if it is not too close to another cluster:
-        bool tooClose = false;
-        
-        // check the cluster that was a problem last time first:
-        if (lastTooCloseClusterIndex<d->clusters.size())
-        {
-          tooClose = QPointSquareDistance(d->clusters.at(lastTooCloseClusterIndex).pixelPos, markerPosition) < pow(ClusterGridSizeScreen/2, 2);
-        }
-        
-        // now check all other clusters:
-        for (int i=0; (!tooClose)&&(i<d->clusters.size()); ++i)
-        {
-          if (i==lastTooCloseClusterIndex)
-              continue;
-            
-          tooClose = QPointSquareDistance(d->clusters.at(i).pixelPos, markerPosition) < pow(ClusterGridSizeScreen/2, 2);
-          if (tooClose)
-            lastTooCloseClusterIndex = i;
-        }
-          
-        if (tooClose)
-        {
-          // move markers into leftover list
-          leftOverList << QPair<QPoint, QIntList>(QPoint(x,y), pixelGrid[index]);
-          pixelGrid[index].clear();
-          pixelGridIndices[pixelGridMetaIndex] = -1;
-        }
-        else
-        {
-          markerMax=pixelGrid[x+y*gridWidth].size();
-          markerX=x;
-          markerY=y;
-          pixelGridMetaIndexMax = pixelGridMetaIndex;
-        }
+        leftOverCells << *it;
+        tooCloseCells.erase(it++);
       }
+      else
+      {
+        ++it;
+      }
+    }
+    
+    // move markers into leftover list, in the order of the cells on the screen
+    std::sort(leftOverCells.begin(), leftOverCells.end());
+    for (QVector<int>::const_iterator it = leftOverCells.constBegin(); it!=leftOverCells.constEnd(); ++it)
+    {
+      const int x = pixelGrid.at(*it).index % gridWidth;
+      const int y = (pixelGrid.at(*it).index-x)/gridWidth;
+      leftOverList << QPair<QPoint, QIntList>(QPoint(x, y), takePixelGridMarkers(&pixelGrid[*it], gridMarkers, sources, order));
     }
     
-    if (markerMax==0)
+    if (bestCell<0)
       break;
     
     // create a cluster at this point:
+    const int markerX = pixelGrid.at(bestCell).index % gridWidth;
+    const int markerY = (pixelGrid.at(bestCell).index-markerX)/gridWidth;
+    freeCellCounts.set(bestCell, 0);
+    const QIntList clusterMarkers = takePixelGridMarkers(&pixelGrid[bestCell], gridMarkers, sources, order);
     ClusterInfo cluster;
-    cluster.setCenter(d->markers.at(pixelGrid[markerX+markerY*gridWidth].first()));
+    cluster.setCenter(d->markers.at(clusterMarkers.first()));
     cluster.pixelPos = QPoint(markerX, markerY);
-    cluster.addMarkerIndices(pixelGrid[markerX+markerY*gridWidth]);
-    pixelGrid[markerX+markerY*gridWidth].clear();
-    pixelGridIndices[pixelGridMetaIndexMax] = -1;
+    cluster.addMarkerIndices(clusterMarkers);
     
     // absorb all markers around it:
-    // Now we only remove the markers from the pixelgrid. They will be cleared from the
-    // pixelGridIndices in the loop above
     // make sure we do not go over the grid boundaries:
     const int eatRadius = gridSize/4;
     const int xStart = std::max( (markerX-eatRadius), 0);
     const int yStart = std::max( (markerY-eatRadius), 0);
     const int xEnd = std::min( (markerX+eatRadius), gridWidth-1);
     const int yEnd = std::min( (markerY+eatRadius), gridHeight-1);
-    for (int indexX=xStart; indexX<=xEnd; ++indexX)
+    
+    // the occupied pixels are found row by row, but absorbed column by column:
+    const QVector<int> eatenCells = pixelGridCellsIn(pixelGrid, gridWidth, QRect(QPoint(xStart, yStart), QPoint(xEnd, yEnd)));
+    QVector<QPair<int, int> > eatenColumns;
+    for (QVector<int>::const_iterator it = eatenCells.constBegin(); it!=eatenCells.constEnd(); ++it)
     {
-      for (int indexY=yStart; indexY<=yEnd; ++indexY)
-      {
-        const int index = indexX + indexY*gridWidth;
-        cluster.addMarkerIndices(pixelGrid[index]);
-        pixelGrid[index].clear();
-      }
+      const int x = pixelGrid.at(*it).index % gridWidth;
+      eatenColumns << QPair<int, int>(x*gridHeight + (pixelGrid.at(*it).index-x)/gridWidth, *it);
+    }
+    std::sort(eatenColumns.begin(), eatenColumns.end());
+    for (QVector<QPair<int, int> >::const_iterator it = eatenColumns.constBegin(); it!=eatenColumns.constEnd(); ++it)
+    {
+      cluster.addMarkerIndices(takePixelGridMarkers(&pixelGrid[it->second], gridMarkers, sources, order));
+      freeCellCounts.set(it->second, 0);
+      tooCloseCells.erase(it->second);
+    }
+    
+    // the cells which are left around the new cluster are too close to it now:
+    const QRect tooCloseArea = QRect(QPoint(std::max(markerX-tooCloseRadius, 0), std::max(markerY-tooCloseRadius, 0)),
+                                     QPoint(std::min(markerX+tooCloseRadius, gridWidth-1), std::min(markerY+tooCloseRadius, gridHeight-1)));
+    const QVector<int> nearCells = pixelGridCellsIn(pixelGrid, gridWidth, tooCloseArea);
+    for (QVector<int>::const_iterator it = nearCells.constBegin(); it!=nearCells.constEnd(); ++it)
+    {
+      PixelGridCell& cell = pixelGrid[*it];
+      const int x = cell.index % gridWidth;
+      const QPoint markerPosition(x, (cell.index-x)/gridWidth);
+      if (cell.tooClose || (QPointSquareDistance(cluster.pixelPos, markerPosition) >= pow(tooCloseRadius, 2)))
+        continue;
+      
+      cell.tooClose = true;
+      freeCellCounts.set(*it, 0);
+      tooCloseCells.insert(*it);
     }
     
+    clusterBins[markerX/tooCloseRadius + (markerY/tooCloseRadius)*clusterBinsPerRow] << d->clusters.count();
     d->clusters<<cluster;
   }
   
@@ -721,16 +1879,25 @@ void MarkerClusterHolder::reorderClustersPixelGrid()
   {
     const QPoint markerPosition = it->first;
 
-    // find the closest cluster:
+    // find the closest cluster. The markers were too close to a cluster, so it is in one of the neighbouring bins:
     int closestSquareDistance = 0;
     int closestIndex = -1;
-    for (int i=0; i<d->clusters.size(); ++i)
+    const int binX = markerPosition.x()/tooCloseRadius;
+    const int binY = markerPosition.y()/tooCloseRadius;
+    for (int y=std::max(binY-1, 0); y<=binY+1; ++y)
     {
-      const int squareDistance = QPointSquareDistance(d->clusters.at(i).pixelPos, markerPosition);
-      if ((closestIndex<0)||(squareDistance<closestSquareDistance))
+      for (int x=std::max(binX-1, 0); x<=std::min(binX+1, clusterBinsPerRow-1); ++x)
       {
-        closestSquareDistance = squareDistance;
-        closestIndex = i;
+        const QIntList bin = clusterBins.value(x + y*clusterBinsPerRow);
+        for (QIntList::const_iterator clusterIt = bin.constBegin(); clusterIt!=bin.constEnd(); ++clusterIt)
+        {
+          const int squareDistance = QPointSquareDistance(d->clusters.at(*clusterIt).pixelPos, markerPosition);
+          if ((closestIndex<0)||(squareDistance<closestSquareDistance)||((squareDistance==closestSquareDistance)&&(*clusterIt<closestIndex)))
+          {
+            closestSquareDistance = squareDistance;
+            closestIndex = *clusterIt;
+          }
+        }
       }
     }
         
@@ -890,6 +2057,24 @@ MarkerClusterHolder::MarkerInfo::List MarkerClusterHolder::indicesToMarkers(cons
   return result;
 }
 
+/**
+ * @brief Returns all markers
+ * @return List of all markers, in the order in which they were added
+ */
+const MarkerClusterHolder::MarkerInfo::List& MarkerClusterHolder::markers() const
+{
+  return d->markers;
+}
+
+/**
+ * @brief Returns the clusters of the last reordering
+ * @return List of clusters
+ */
+const MarkerClusterHolder::ClusterInfo::List& MarkerClusterHolder::clusters() const
+{
+  return d->clusters;
+}
+
 /**
  * @brief returns the currently selected markers
  * @return List of currently selected markers
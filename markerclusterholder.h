@@ -39,6 +39,9 @@ class MarkerClusterHolder : public QObject
   public:
     
     typedef QList<int> QIntList;
+
+    //! size in pixels of the cells of the grid in which the markers are clustered
+    static const int ClusterGridSizeScreen = 60;
     
     /**
      * @brief Information about a marker
@@ -354,6 +357,9 @@ class MarkerClusterHolder : public QObject
     ~MarkerClusterHolder();
     void addMarker(const MarkerInfo& marker);
     void addMarkers(const QList<MarkerInfo>& markerList);
+    void insertMarkers(const int index, const QList<MarkerInfo>& markerList);
+    void setMarkers(const QList<MarkerInfo>& markerList);
+    void moveMarkers(const int start, const int end, const int destination);
     void removeMarkers(const QList<MarkerInfo>& markerList);
     void removeMarkers(const QIntList& markerIndices);
     void removeMarkers(const int start, const int end);
@@ -364,9 +370,12 @@ class MarkerClusterHolder : public QObject
     MarkerInfo::List selectedMarkers() const;
     MarkerInfo::List soloMarkers() const;
     MarkerInfo::List indicesToMarkers(const QIntList indicesList) const;
+    const MarkerInfo::List& markers() const;
+    const ClusterInfo::List& clusters() const;
     void setMarkerDataEqualFunction(const MarkerDataEqualFunction compareFunction, void* const yourdata);
     void setClusterPixmapFunction(const ClusterPixmapFunction clusterPixmapFunction, void* const yourdata);
     int findClusterAt(const QPoint pos) const;
+    QIntList visibleMarkers(const int maxCount);
     
   protected:
 // event filter for mouse clicks does not work reliably in <0.8, no idea why...
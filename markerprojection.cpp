@@ -0,0 +1,443 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// C++ includes
+#include <cmath>
+#include <limits>
+
+// local includes
+#include "markerprojection.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define MARKERPROJECTION_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX is only used if the CPU has it, which needs per-function target attributes:
+#if defined(MARKERPROJECTION_SSE2) && defined(__GNUC__) && \
+    (defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define MARKERPROJECTION_AVX
+#include <immintrin.h>
+#endif
+
+const double Pi = 3.14159265358979323846;
+
+const double MarkerProjection::MercatorMaximumLatitude = 85.05113;
+
+/**
+ * @brief Helper function, returns the latitude on the Mercator map in radians
+ */
+static double mercatorLatitude(const double latitude)
+{
+  if (std::fabs(latitude)>MarkerProjection::MercatorMaximumLatitude)
+    return latitude>0 ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity();
+
+  const double radians = latitude * Pi / 180.0;
+  return std::log(std::tan(Pi/4.0 + radians/2.0));
+}
+
+/**
+ * @brief The parameters of the view, as used by the kernels
+ *
+ * The flat kernels use the center and the scale, the spherical kernels use
+ * the rotation and the radius.
+ */
+struct KernelParameters
+{
+  double centerX;
+  double centerY;
+  double width;
+  double height;
+  double centerLongitude;
+  double centerLatitude;
+  double scale;
+  double sinLongitude;
+  double cosLongitude;
+  double sinLatitude;
+  double cosLatitude;
+  double radius;
+};
+
+/*
+ * Flat kernels: shift the longitude into [-Pi, Pi) around the center and
+ * scale both coordinates. The latitudes are the Mercator latitudes for the
+ * Mercator map.
+ *
+ * Spherical kernels: rotate the point on the unit sphere so that the center
+ * faces the viewer, the point is visible if it is in front of the globe.
+ *
+ * All variants do the same operations in the same order, so that they give
+ * the same results.
+ */
+typedef void (*FlatKernelFunction)(const KernelParameters &p, const double *longitudes, const double *latitudes,
+                                   const int count, double *x, double *y, uchar *visible);
+typedef void (*SphericalKernelFunction)(const KernelParameters &p, const double *sphereX, const double *sphereY,
+                                        const double *sphereZ, const int count, double *x, double *y, uchar *visible);
+
+static void flatKernelScalar(const KernelParameters &p, const double *longitudes, const double *latitudes,
+                             const int start, const int count, double *x, double *y, uchar *visible)
+{
+  for (int i=start; i<count; ++i)
+  {
+    double longitude = longitudes[i] - p.centerLongitude;
+    if (longitude<-Pi)
+      longitude+= 2.0*Pi;
+    if (longitude>=Pi)
+      longitude-= 2.0*Pi;
+
+    x[i] = p.centerX + longitude * p.scale;
+    y[i] = p.centerY - (latitudes[i] - p.centerLatitude) * p.scale;
+    visible[i] = (x[i]>=0.0)&&(x[i]<p.width)&&(y[i]>=0.0)&&(y[i]<p.height);
+  }
+}
+
+static void sphericalKernelScalar(const KernelParameters &p, const double *sphereX, const double *sphereY,
+                                  const double *sphereZ, const int start, const int count,
+                                  double *x, double *y, uchar *visible)
+{
+  for (int i=start; i<count; ++i)
+  {
+    const double u = sphereZ[i] * p.cosLongitude + sphereX[i] * p.sinLongitude;
+    const double rotatedX = sphereX[i] * p.cosLongitude - sphereZ[i] * p.sinLongitude;
+    const double rotatedY = sphereY[i] * p.cosLatitude - u * p.sinLatitude;
+    const double rotatedZ = sphereY[i] * p.sinLatitude + u * p.cosLatitude;
+
+    x[i] = p.centerX + p.radius * rotatedX;
+    y[i] = p.centerY - p.radius * rotatedY;
+    visible[i] = (rotatedZ>0.0)&&(x[i]>=0.0)&&(x[i]<p.width)&&(y[i]>=0.0)&&(y[i]<p.height);
+  }
+}
+
+#ifndef MARKERPROJECTION_SSE2
+static void flatKernelGeneric(const KernelParameters &p, const double *longitudes, const double *latitudes,
+                              const int count, double *x, double *y, uchar *visible)
+{
+  flatKernelScalar(p, longitudes, latitudes, 0, count, x, y, visible);
+}
+
+static void sphericalKernelGeneric(const KernelParameters &p, const double *sphereX, const double *sphereY,
+                                   const double *sphereZ, const int count, double *x, double *y, uchar *visible)
+{
+  sphericalKernelScalar(p, sphereX, sphereY, sphereZ, 0, count, x, y, visible);
+}
+#endif
+
+#ifdef MARKERPROJECTION_SSE2
+static inline __m128d insideSse2(const __m128d x, const __m128d y, const __m128d width, const __m128d height)
+{
+  const __m128d zero = _mm_setzero_pd();
+  return _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(x, zero), _mm_cmplt_pd(x, width)),
+                    _mm_and_pd(_mm_cmpge_pd(y, zero), _mm_cmplt_pd(y, height)));
+}
+
+static inline void storeVisibleSse2(const __m128d mask, uchar *visible)
+{
+  const int bits = _mm_movemask_pd(mask);
+  visible[0] = bits & 1;
+  visible[1] = (bits >> 1) & 1;
+}
+
+static void flatKernelSse2(const KernelParameters &p, const double *longitudes, const double *latitudes,
+                           const int count, double *x, double *y, uchar *visible)
+{
+  const __m128d pi = _mm_set1_pd(Pi);
+  const __m128d minusPi = _mm_set1_pd(-Pi);
+  const __m128d twoPi = _mm_set1_pd(2.0*Pi);
+  const __m128d centerX = _mm_set1_pd(p.centerX);
+  const __m128d centerY = _mm_set1_pd(p.centerY);
+  const __m128d width = _mm_set1_pd(p.width);
+  const __m128d height = _mm_set1_pd(p.height);
+  const __m128d centerLongitude = _mm_set1_pd(p.centerLongitude);
+  const __m128d centerLatitude = _mm_set1_pd(p.centerLatitude);
+  const __m128d scale = _mm_set1_pd(p.scale);
+  int i = 0;
+  for (; i + 2 <= count; i += 2)
+  {
+    __m128d longitude = _mm_sub_pd(_mm_loadu_pd(longitudes + i), centerLongitude);
+    longitude = _mm_add_pd(longitude, _mm_and_pd(_mm_cmplt_pd(longitude, minusPi), twoPi));
+    longitude = _mm_sub_pd(longitude, _mm_and_pd(_mm_cmpge_pd(longitude, pi), twoPi));
+
+    const __m128d px = _mm_add_pd(centerX, _mm_mul_pd(longitude, scale));
+    const __m128d py = _mm_sub_pd(centerY, _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(latitudes + i), centerLatitude), scale));
+    _mm_storeu_pd(x + i, px);
+    _mm_storeu_pd(y + i, py);
+    storeVisibleSse2(insideSse2(px, py, width, height), visible + i);
+  }
+
+  flatKernelScalar(p, longitudes, latitudes, i, count, x, y, visible);
+}
+
+static void sphericalKernelSse2(const KernelParameters &p, const double *sphereX, const double *sphereY,
+                                const double *sphereZ, const int count, double *x, double *y, uchar *visible)
+{
+  const __m128d centerX = _mm_set1_pd(p.centerX);
+  const __m128d centerY = _mm_set1_pd(p.centerY);
+  const __m128d width = _mm_set1_pd(p.width);
+  const __m128d height = _mm_set1_pd(p.height);
+  const __m128d sinLongitude = _mm_set1_pd(p.sinLongitude);
+  const __m128d cosLongitude = _mm_set1_pd(p.cosLongitude);
+  const __m128d sinLatitude = _mm_set1_pd(p.sinLatitude);
+  const __m128d cosLatitude = _mm_set1_pd(p.cosLatitude);
+  const __m128d radius = _mm_set1_pd(p.radius);
+  int i = 0;
+  for (; i + 2 <= count; i += 2)
+  {
+    const __m128d sx = _mm_loadu_pd(sphereX + i);
+    const __m128d sy = _mm_loadu_pd(sphereY + i);
+    const __m128d sz = _mm_loadu_pd(sphereZ + i);
+    const __m128d u = _mm_add_pd(_mm_mul_pd(sz, cosLongitude), _mm_mul_pd(sx, sinLongitude));
+    const __m128d rotatedX = _mm_sub_pd(_mm_mul_pd(sx, cosLongitude), _mm_mul_pd(sz, sinLongitude));
+    const __m128d rotatedY = _mm_sub_pd(_mm_mul_pd(sy, cosLatitude), _mm_mul_pd(u, sinLatitude));
+    const __m128d rotatedZ = _mm_add_pd(_mm_mul_pd(sy, sinLatitude), _mm_mul_pd(u, cosLatitude));
+
+    const __m128d px = _mm_add_pd(centerX, _mm_mul_pd(radius, rotatedX));
+    const __m128d py = _mm_sub_pd(centerY, _mm_mul_pd(radius, rotatedY));
+    _mm_storeu_pd(x + i, px);
+    _mm_storeu_pd(y + i, py);
+    const __m128d front = _mm_cmpgt_pd(rotatedZ, _mm_setzero_pd());
+    storeVisibleSse2(_mm_and_pd(front, insideSse2(px, py, width, height)), visible + i);
+  }
+
+  sphericalKernelScalar(p, sphereX, sphereY, sphereZ, i, count, x, y, visible);
+}
+#endif
+
+#ifdef MARKERPROJECTION_AVX
+__attribute__((target("avx")))
+static inline __m256d insideAvx(const __m256d x, const __m256d y, const __m256d width, const __m256d height)
+{
+  const __m256d zero = _mm256_setzero_pd();
+  return _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x, zero, _CMP_GE_OQ), _mm256_cmp_pd(x, width, _CMP_LT_OQ)),
+                       _mm256_and_pd(_mm256_cmp_pd(y, zero, _CMP_GE_OQ), _mm256_cmp_pd(y, height, _CMP_LT_OQ)));
+}
+
+__attribute__((target("avx")))
+static inline void storeVisibleAvx(const __m256d mask, uchar *visible)
+{
+  const int bits = _mm256_movemask_pd(mask);
+  visible[0] = bits & 1;
+  visible[1] = (bits >> 1) & 1;
+  visible[2] = (bits >> 2) & 1;
+  visible[3] = (bits >> 3) & 1;
+}
+
+__attribute__((target("avx")))
+static void flatKernelAvx(const KernelParameters &p, const double *longitudes, const double *latitudes,
+                          const int count, double *x, double *y, uchar *visible)
+{
+  const __m256d pi = _mm256_set1_pd(Pi);
+  const __m256d minusPi = _mm256_set1_pd(-Pi);
+  const __m256d twoPi = _mm256_set1_pd(2.0*Pi);
+  const __m256d centerX = _mm256_set1_pd(p.centerX);
+  const __m256d centerY = _mm256_set1_pd(p.centerY);
+  const __m256d width = _mm256_set1_pd(p.width);
+  const __m256d height = _mm256_set1_pd(p.height);
+  const __m256d centerLongitude = _mm256_set1_pd(p.centerLongitude);
+  const __m256d centerLatitude = _mm256_set1_pd(p.centerLatitude);
+  const __m256d scale = _mm256_set1_pd(p.scale);
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256d longitude = _mm256_sub_pd(_mm256_loadu_pd(longitudes + i), centerLongitude);
+    longitude = _mm256_add_pd(longitude, _mm256_and_pd(_mm256_cmp_pd(longitude, minusPi, _CMP_LT_OQ), twoPi));
+    longitude = _mm256_sub_pd(longitude, _mm256_and_pd(_mm256_cmp_pd(longitude, pi, _CMP_GE_OQ), twoPi));
+
+    const __m256d px = _mm256_add_pd(centerX, _mm256_mul_pd(longitude, scale));
+    const __m256d py = _mm256_sub_pd(centerY, _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(latitudes + i), centerLatitude), scale));
+    _mm256_storeu_pd(x + i, px);
+    _mm256_storeu_pd(y + i, py);
+    storeVisibleAvx(insideAvx(px, py, width, height), visible + i);
+  }
+
+  flatKernelScalar(p, longitudes, latitudes, i, count, x, y, visible);
+}
+
+__attribute__((target("avx")))
+static void sphericalKernelAvx(const KernelParameters &p, const double *sphereX, const double *sphereY,
+                               const double *sphereZ, const int count, double *x, double *y, uchar *visible)
+{
+  const __m256d centerX = _mm256_set1_pd(p.centerX);
+  const __m256d centerY = _mm256_set1_pd(p.centerY);
+  const __m256d width = _mm256_set1_pd(p.width);
+  const __m256d height = _mm256_set1_pd(p.height);
+  const __m256d sinLongitude = _mm256_set1_pd(p.sinLongitude);
+  const __m256d cosLongitude = _mm256_set1_pd(p.cosLongitude);
+  const __m256d sinLatitude = _mm256_set1_pd(p.sinLatitude);
+  const __m256d cosLatitude = _mm256_set1_pd(p.cosLatitude);
+  const __m256d radius = _mm256_set1_pd(p.radius);
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    const __m256d sx = _mm256_loadu_pd(sphereX + i);
+    const __m256d sy = _mm256_loadu_pd(sphereY + i);
+    const __m256d sz = _mm256_loadu_pd(sphereZ + i);
+    const __m256d u = _mm256_add_pd(_mm256_mul_pd(sz, cosLongitude), _mm256_mul_pd(sx, sinLongitude));
+    const __m256d rotatedX = _mm256_sub_pd(_mm256_mul_pd(sx, cosLongitude), _mm256_mul_pd(sz, sinLongitude));
+    const __m256d rotatedY = _mm256_sub_pd(_mm256_mul_pd(sy, cosLatitude), _mm256_mul_pd(u, sinLatitude));
+    const __m256d rotatedZ = _mm256_add_pd(_mm256_mul_pd(sy, sinLatitude), _mm256_mul_pd(u, cosLatitude));
+
+    const __m256d px = _mm256_add_pd(centerX, _mm256_mul_pd(radius, rotatedX));
+    const __m256d py = _mm256_sub_pd(centerY, _mm256_mul_pd(radius, rotatedY));
+    _mm256_storeu_pd(x + i, px);
+    _mm256_storeu_pd(y + i, py);
+    const __m256d front = _mm256_cmp_pd(rotatedZ, _mm256_setzero_pd(), _CMP_GT_OQ);
+    storeVisibleAvx(_mm256_and_pd(front, insideAvx(px, py, width, height)), visible + i);
+  }
+
+  sphericalKernelScalar(p, sphereX, sphereY, sphereZ, i, count, x, y, visible);
+}
+#endif
+
+static FlatKernelFunction selectFlatKernel()
+{
+#ifdef MARKERPROJECTION_AVX
+  if (__builtin_cpu_supports("avx"))
+    return flatKernelAvx;
+#endif
+#ifdef MARKERPROJECTION_SSE2
+  return flatKernelSse2;
+#else
+  return flatKernelGeneric;
+#endif
+}
+
+static SphericalKernelFunction selectSphericalKernel()
+{
+#ifdef MARKERPROJECTION_AVX
+  if (__builtin_cpu_supports("avx"))
+    return sphericalKernelAvx;
+#endif
+#ifdef MARKERPROJECTION_SSE2
+  return sphericalKernelSse2;
+#else
+  return sphericalKernelGeneric;
+#endif
+}
+
+MarkerProjection::MarkerProjection()
+: m_longitudes(),
+  m_latitudes(),
+  m_mercatorLatitudes(),
+  m_sphereX(),
+  m_sphereY(),
+  m_sphereZ()
+{
+}
+
+void MarkerProjection::clear()
+{
+  m_longitudes.clear();
+  m_latitudes.clear();
+  m_mercatorLatitudes.clear();
+  m_sphereX.clear();
+  m_sphereY.clear();
+  m_sphereZ.clear();
+}
+
+/**
+ * @brief Computes the parts of the projection which do not depend on the view
+ * @param longitudes Longitudes of the markers in degrees
+ * @param latitudes Latitudes of the markers in degrees
+ * @param count Number of markers
+ */
+void MarkerProjection::setCoordinates(const double *longitudes, const double *latitudes, const int count)
+{
+  m_longitudes.resize(count);
+  m_latitudes.resize(count);
+  m_mercatorLatitudes.resize(count);
+  m_sphereX.resize(count);
+  m_sphereY.resize(count);
+  m_sphereZ.resize(count);
+  for (int i=0; i<count; ++i)
+  {
+    const double longitude = longitudes[i] * Pi / 180.0;
+    const double latitude = latitudes[i] * Pi / 180.0;
+    m_longitudes[i] = longitude;
+    m_latitudes[i] = latitude;
+    m_mercatorLatitudes[i] = mercatorLatitude(latitudes[i]);
+    m_sphereX[i] = std::cos(latitude) * std::sin(longitude);
+    m_sphereY[i] = std::sin(latitude);
+    m_sphereZ[i] = std::cos(latitude) * std::cos(longitude);
+  }
+}
+
+int MarkerProjection::count() const
+{
+  return m_longitudes.count();
+}
+
+/**
+ * @brief Projects markers onto the map
+ * @param view The view of the map
+ * @param markers Indices of the markers to project
+ * @param count Number of markers to project
+ * @param x Receives the x coordinates of the markers in pixels
+ * @param y Receives the y coordinates of the markers in pixels
+ * @param visible Receives whether the markers are visible on the map
+ */
+void MarkerProjection::project(const View &view, const int *markers, const int count,
+                               double *x, double *y, uchar *visible) const
+{
+  static const FlatKernelFunction flatKernel = selectFlatKernel();
+  static const SphericalKernelFunction sphericalKernel = selectSphericalKernel();
+
+  const double centerLongitude = view.centerLongitude * Pi / 180.0;
+  const double centerLatitude = view.centerLatitude * Pi / 180.0;
+
+  KernelParameters p;
+  p.centerX = view.width / 2.0;
+  p.centerY = view.height / 2.0;
+  p.width = view.width;
+  p.height = view.height;
+  p.centerLongitude = centerLongitude;
+  p.centerLatitude = centerLatitude;
+  p.scale = 2.0 * view.radius / Pi;
+  p.sinLongitude = std::sin(centerLongitude);
+  p.cosLongitude = std::cos(centerLongitude);
+  p.sinLatitude = std::sin(centerLatitude);
+  p.cosLatitude = std::cos(centerLatitude);
+  p.radius = view.radius;
+
+  // the kernels read contiguous arrays, gather the coordinates of the markers:
+  if (view.projection==Spherical)
+  {
+    QVector<double> sphereX(count);
+    QVector<double> sphereY(count);
+    QVector<double> sphereZ(count);
+    for (int i=0; i<count; ++i)
+    {
+      sphereX[i] = m_sphereX.at(markers[i]);
+      sphereY[i] = m_sphereY.at(markers[i]);
+      sphereZ[i] = m_sphereZ.at(markers[i]);
+    }
+    sphericalKernel(p, sphereX.constData(), sphereY.constData(), sphereZ.constData(), count, x, y, visible);
+    return;
+  }
+
+  const QVector<double>& sourceLatitudes = (view.projection==Mercator) ? m_mercatorLatitudes : m_latitudes;
+  if (view.projection==Mercator)
+    p.centerLatitude = mercatorLatitude(view.centerLatitude);
+
+  QVector<double> gatheredLongitudes(count);
+  QVector<double> gatheredLatitudes(count);
+  for (int i=0; i<count; ++i)
+  {
+    gatheredLongitudes[i] = m_longitudes.at(markers[i]);
+    gatheredLatitudes[i] = sourceLatitudes.at(markers[i]);
+  }
+  flatKernel(p, gatheredLongitudes.constData(), gatheredLatitudes.constData(), count, x, y, visible);
+}
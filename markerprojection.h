@@ -0,0 +1,81 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MARKERPROJECTION_H
+#define MARKERPROJECTION_H
+
+// Qt includes
+#include <QVector>
+
+/**
+ * @brief Projects many markers onto the map at once
+ *
+ * The parts of the projection which do not depend on the view are computed
+ * once per marker in setCoordinates(): the longitude in radians, the Mercator
+ * latitude and the point on the unit sphere. project() then only has to
+ * shift, rotate and scale them, which is done for several markers at once
+ * with SSE2, or AVX if the CPU has it.
+ *
+ * The results are those of Marble's Spherical, Equirectangular and Mercator
+ * projections without a heading: markers on the back of the globe, beyond
+ * the Mercator limits or outside the map are not visible. On the flat maps
+ * the copy of a marker closest to the center is used.
+ */
+class MarkerProjection
+{
+  public:
+    enum Projection
+    {
+      Spherical,
+      Equirectangular,
+      Mercator
+    };
+
+    struct View
+    {
+      Projection projection;
+      //! center of the map in degrees
+      double centerLongitude;
+      double centerLatitude;
+      //! radius of the globe in pixels
+      int radius;
+      //! size of the map in pixels
+      int width;
+      int height;
+    };
+
+    //! Marble does not show the Mercator map beyond this latitude in degrees, atan(sinh(Pi))
+    static const double MercatorMaximumLatitude;
+
+    MarkerProjection();
+
+    void clear();
+    void setCoordinates(const double *longitudes, const double *latitudes, const int count);
+    int count() const;
+    void project(const View &view, const int *markers, const int count,
+                 double *x, double *y, uchar *visible) const;
+
+  private:
+    QVector<double> m_longitudes;
+    QVector<double> m_latitudes;
+    QVector<double> m_mercatorLatitudes;
+    QVector<double> m_sphereX;
+    QVector<double> m_sphereY;
+    QVector<double> m_sphereZ;
+};
+
+#endif
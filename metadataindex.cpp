@@ -0,0 +1,168 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "metadataindex.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QMutexLocker>
+
+const quint32 MetadataIndexMagic = 0x5452494D; // "TRIM"
+const quint32 MetadataIndexVersion = 1;
+// compact the file on startup if less than this fraction of the records is still in use:
+const qreal MetadataIndexCompactThreshold = 0.5;
+
+static void writeEntry(QDataStream &stream, const QString &path, const MetadataIndex::Entry &entry)
+{
+  stream << path << entry.size << entry.modified << quint8(entry.status)
+         << double(entry.gpsLat) << double(entry.gpsLong) << entry.timestamp;
+}
+
+MetadataIndex::MetadataIndex(const QString &filename)
+  : m_file(filename), m_entries(), m_mutex()
+{
+  QDir().mkpath(QFileInfo(filename).absolutePath());
+  load();
+}
+
+MetadataIndex::~MetadataIndex()
+{
+  m_file.close();
+}
+
+void MetadataIndex::load()
+{
+  int recordCount = 0;
+  qint64 validSize = 0;
+
+  if (m_file.open(QIODevice::ReadOnly))
+  {
+    QDataStream stream(&m_file);
+    stream.setVersion(QDataStream::Qt_4_5);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if ((magic == MetadataIndexMagic) && (version == MetadataIndexVersion))
+    {
+      validSize = m_file.pos();
+      while (!stream.atEnd())
+      {
+        QString path;
+        Entry entry;
+        quint8 status = 0;
+        double gpsLat = 0;
+        double gpsLong = 0;
+        stream >> path >> entry.size >> entry.modified >> status >> gpsLat >> gpsLong >> entry.timestamp;
+        if (stream.status() != QDataStream::Ok)
+          break; // the last record was not written completely
+
+        entry.status = Status(status);
+        entry.gpsLat = gpsLat;
+        entry.gpsLong = gpsLong;
+        m_entries.insert(path, entry);
+        ++recordCount;
+        validSize = m_file.pos();
+      }
+    }
+
+    m_file.close();
+  }
+
+  if ((validSize == 0) || (m_entries.size() < recordCount * MetadataIndexCompactThreshold))
+  {
+    compact();
+    return;
+  }
+
+  // cut off a partially written record before appending new ones:
+  if (validSize < m_file.size())
+    m_file.resize(validSize);
+
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+    qDebug() << "MetadataIndex: can not open" << m_file.fileName();
+}
+
+/*
+ * Rewrites the index with only the current records.
+ */
+void MetadataIndex::compact()
+{
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    qDebug() << "MetadataIndex: can not open" << m_file.fileName();
+    return;
+  }
+
+  QDataStream stream(&m_file);
+  stream.setVersion(QDataStream::Qt_4_5);
+  stream << MetadataIndexMagic << MetadataIndexVersion;
+  for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it!=m_entries.constEnd(); ++it)
+  {
+    writeEntry(stream, it.key(), it.value());
+  }
+  m_file.flush();
+}
+
+/*
+ * Returns true and fills entry if the index knows the file in its current state.
+ */
+bool MetadataIndex::lookup(const QFileInfo &info, Entry *entry) const
+{
+  const QString path = info.canonicalFilePath();
+  if (path.isEmpty())
+    return false;
+
+  QMutexLocker locker(&m_mutex);
+  const QHash<QString, Entry>::const_iterator it = m_entries.constFind(path);
+  if (it == m_entries.constEnd())
+    return false;
+
+  if ((it->size != info.size()) || (it->modified != info.lastModified().toTime_t()))
+    return false;
+
+  *entry = it.value();
+  return true;
+}
+
+void MetadataIndex::store(const QFileInfo &info, const Status status, const qreal gpsLat, const qreal gpsLong,
+                          const QDateTime &timestamp)
+{
+  const QString path = info.canonicalFilePath();
+  if (path.isEmpty())
+    return;
+
+  Entry entry;
+  entry.size = info.size();
+  entry.modified = info.lastModified().toTime_t();
+  entry.status = status;
+  entry.gpsLat = gpsLat;
+  entry.gpsLong = gpsLong;
+  entry.timestamp = timestamp;
+
+  QMutexLocker locker(&m_mutex);
+  m_entries.insert(path, entry);
+
+  if (!m_file.isOpen())
+    return;
+
+  QDataStream stream(&m_file);
+  stream.setVersion(QDataStream::Qt_4_5);
+  writeEntry(stream, path, entry);
+  m_file.flush();
+}
@@ -0,0 +1,82 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef METADATAINDEX_H
+#define METADATAINDEX_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+/**
+ * Persistent index of the metadata of imported files.
+ *
+ * The index is an append-only binary file which is read completely on
+ * startup. Every record stores the geotag, the timestamp and the status of
+ * a file together with the size and modification time of the file, so that
+ * changed files are parsed again. Files without a geotag are recorded as
+ * well, so that a rescan does not open them again. Records which have been
+ * superseded are dropped when the index is compacted on startup.
+ */
+class MetadataIndex
+{
+  public:
+    enum Status
+    {
+      GeoTagged = 0,
+      NotGeoTagged = 1,
+      Failed = 2
+    };
+
+    struct Entry
+    {
+      Entry()
+        : size(0), modified(0), status(Failed), gpsLat(-1), gpsLong(-1), timestamp()
+      {
+      }
+
+      qint64 size;
+      qint64 modified;
+      Status status;
+      qreal gpsLat;
+      qreal gpsLong;
+      QDateTime timestamp;
+    };
+
+    MetadataIndex(const QString &filename);
+    ~MetadataIndex();
+
+    bool lookup(const QFileInfo &info, Entry *entry) const;
+    void store(const QFileInfo &info, const Status status, const qreal gpsLat = -1, const qreal gpsLong = -1,
+               const QDateTime &timestamp = QDateTime());
+
+  private:
+    void load();
+    void compact();
+
+    QFile m_file;
+    QHash<QString, Entry> m_entries;
+    mutable QMutex m_mutex;
+
+  private:
+    Q_DISABLE_COPY(MetadataIndex)
+};
+
+#endif
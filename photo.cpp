@@ -18,93 +18,128 @@
 */
 
 #include "photo.h"
+#include "photofile.h"
+#include "thumbnailloader.h"
+#include "thumbnailstore.h"
 #include <QFile>
 
 Photo::Photo(const QString &path)
-  : m_timestamp(), m_gpsLat(-1), m_gpsLong(-1), m_filename(path), m_thumbnail()
+  : d(new PhotoData(path, QDateTime(), -1, -1))
 {
-  Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(QFile::encodeName(path).constData());
-  image->readMetadata();
-  Exiv2::ExifData &exifData = image->exifData();
- 
-  if (exifData.empty()) {
-    qDebug() << "Whoops! Couldnt find any metadata in" << path;  
+  if (path.isEmpty())
     return;
-  }
 
-  if (!exivHasKey("Exif.GPSInfo.GPSLatitudeRef", exifData))
+  // try the fast path first, it only reads the EXIF segment of the file:
+  ExifScanner scanner;
+  const ExifScanner::Result result = scanner.scanFile(path);
+  if ((result == ExifScanner::Ok) || (result == ExifScanner::NoExif))
   {
+    readMetadata(result, scanner);
     return;
   }
-  
-  if (!exivHasKey("Exif.GPSInfo.GPSLongitudeRef", exifData))
+
+  // odd file, let Exiv2 have a look at it
+  Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(QFile::encodeName(d->m_filename).constData());
+  readMetadataWithExiv2(*image);
+}
+
+/*
+ * Reads the metadata from a file which is already in memory. The file may
+ * only hold the start of the photo, so whenever the scanner can not handle
+ * it, Exiv2 reads the photo from the disk.
+ */
+Photo::Photo(const PhotoFile &file)
+  : d(new PhotoData(file.getFilename(), QDateTime(), -1, -1))
+{
+  ExifScanner scanner;
+  const ExifScanner::Result result = scanner.scan(file.data(), file.size());
+  if ((result == ExifScanner::Ok) || (result == ExifScanner::NoExif))
   {
+    readMetadata(result, scanner);
     return;
   }
-  
-  if (!exivHasKey("Exif.GPSInfo.GPSLatitude", exifData))
+
+  Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(QFile::encodeName(d->m_filename).constData());
+  readMetadataWithExiv2(*image);
+}
+
+// creates a Photo from previously read metadata, the file is not opened
+Photo::Photo(const QString &path, const QDateTime &timestamp, const qreal gpsLat, const qreal gpsLong)
+  : d(new PhotoData(path, timestamp, gpsLat, gpsLong))
+{
+}
+
+void Photo::readMetadata(const ExifScanner::Result result, const ExifScanner &scanner)
+{
+  if (result == ExifScanner::NoExif)
   {
+    qDebug() << "Whoops! Couldnt find any metadata in" << d->m_filename;
     return;
   }
-  
-  if (!exivHasKey("Exif.GPSInfo.GPSLongitude", exifData))
+
+  if (scanner.hasGpsPosition() && scanner.hasDateTimeOriginal())
   {
-    return;
+    d->m_gpsLat = scanner.getGpsLat();
+    d->m_gpsLong = scanner.getGpsLong();
+    d->m_timestamp = scanner.getDateTimeOriginal();
   }
-  
-  if (!exivHasKey("Exif.Photo.DateTimeOriginal", exifData))
-  {
+}
+
+void Photo::readMetadataWithExiv2(Exiv2::Image &image)
+{
+  image.readMetadata();
+  Exiv2::ExifData &exifData = image.exifData();
+ 
+  if (exifData.empty()) {
+    qDebug() << "Whoops! Couldnt find any metadata in" << d->m_filename;
     return;
   }
 
-  QString gpsLatRef = QString::fromStdString(exifData["Exif.GPSInfo.GPSLatitudeRef"].value().toString());
-  QString gpsLongRef = QString::fromStdString(exifData["Exif.GPSInfo.GPSLongitudeRef"].value().toString());
-
-  m_gpsLat = convertToCoordinate(
-              QString::fromStdString(exifData["Exif.GPSInfo.GPSLatitude"].value().toString())
-              , gpsLatRef
-  );
+  const Exiv2::ExifData::const_iterator gpsLatRef = exifData.findKey(Exiv2::ExifKey("Exif.GPSInfo.GPSLatitudeRef"));
+  const Exiv2::ExifData::const_iterator gpsLongRef = exifData.findKey(Exiv2::ExifKey("Exif.GPSInfo.GPSLongitudeRef"));
+  const Exiv2::ExifData::const_iterator gpsLat = exifData.findKey(Exiv2::ExifKey("Exif.GPSInfo.GPSLatitude"));
+  const Exiv2::ExifData::const_iterator gpsLong = exifData.findKey(Exiv2::ExifKey("Exif.GPSInfo.GPSLongitude"));
+  const Exiv2::ExifData::const_iterator dateTime = exifData.findKey(Exiv2::ExifKey("Exif.Photo.DateTimeOriginal"));
 
-  m_gpsLong = convertToCoordinate(
-              QString::fromStdString(exifData["Exif.GPSInfo.GPSLongitude"].value().toString())
-              , gpsLongRef
-  );
+  if ((gpsLatRef == exifData.end()) || (gpsLongRef == exifData.end()) ||
+      (gpsLat == exifData.end()) || (gpsLong == exifData.end()) ||
+      (dateTime == exifData.end()))
+  {
+    return;
+  }
 
-  m_timestamp = QDateTime::fromString(
-                QString::fromStdString(exifData["Exif.Photo.DateTimeOriginal"].value().toString()),
-                "yyyy:MM:dd HH:mm:ss");
-}
+  d->m_gpsLat = convertToCoordinate(*gpsLat, *gpsLatRef);
+  d->m_gpsLong = convertToCoordinate(*gpsLong, *gpsLongRef);
 
-bool Photo::exivHasKey(const QString &key, Exiv2::ExifData &data)
-{
-  Exiv2::ExifData::iterator pos = data.findKey(Exiv2::ExifKey(key.toStdString()));
-  return (pos != data.end());
+  const std::string dateTimeString = dateTime->toString();
+  d->m_timestamp = ExifScanner::parseDateTime(dateTimeString.data(), dateTimeString.size());
 }
 
-QImage Photo::getThumbnailImage() const
+// returns the thumbnail level which covers the given size, it may be larger
+QImage Photo::getThumbnailImage(const QSize &size) const
 {
-  if (m_thumbnail.width()==0)
-    m_thumbnail = getImage().scaled(QSize(280, 280), Qt::KeepAspectRatio);
+  if (d->m_thumbnailStore)
+    return d->m_thumbnailStore->thumbnail(d->m_filename, size);
 
-  return m_thumbnail;
+  return ThumbnailLoader::load(d->m_filename, ThumbnailStore::levelSize(ThumbnailStore::levelFor(size)));
 }
 
-QPixmap Photo::getThumbnailPixmap() const
+QPixmap Photo::getThumbnailPixmap(const QSize &size) const
 {
-  return QPixmap::fromImage(getThumbnailImage());
+  return QPixmap::fromImage(getThumbnailImage(size));
 }
 
 QPixmap Photo::getPixmap() const
 {
-  return QPixmap(m_filename);
+  return QPixmap(d->m_filename);
 }
 
 QImage Photo::getImage() const
 {
-  return QImage(m_filename);
+  return QImage(d->m_filename);
 }
 
-qreal Photo::convertToCoordinate(const QString &coord, const QString &ref)
+qreal Photo::convertToCoordinate(const Exiv2::Exifdatum &coord, const Exiv2::Exifdatum &ref)
 {
   /*
   *Format comes in as "59/1 56/1 1288/100" and "E"
@@ -113,31 +148,18 @@ qreal Photo::convertToCoordinate(const QString &coord, const QString &ref)
   */
  
   qreal total = 0;
-  QStringList points = coord.split(" ");
-
-  qreal temp = 0;
+  qreal divisor = 1;
 
-  for (int i=0; i < points.size(); ++i)
+  for (long i=0; (i < coord.count()) && (i < 3); ++i)
   {
-    QStringList value = points[i].split("/");
-    temp = value[0].toFloat() / value[1].toFloat();
-    switch (i) 
-    {
-      case 0:
-        total += temp;
-        break;
-      case 1:
-        total += temp/60;
-        break;
-      case 2:
-        total += temp/3600;
-        break;
-    }
+    const Exiv2::Rational value = coord.toRational(i);
+    total += qreal(value.first) / qreal(value.second) / divisor;
+    divisor *= 60;
   }
 
-  if (ref == "W" || ref == "S")
+  const std::string refString = ref.toString();
+  if (refString == "W" || refString == "S")
     total *= -1;
 
   return total;
 }
-
@@ -21,43 +21,72 @@
 #define PHOTO_H
 
 #include <QMetaType>
+#include <QSharedData>
+#include <QSharedDataPointer>
 
 #include <QPixmap>
 #include <QDateTime>
 #include <QDebug>
 #include <QImage>
-#include <QIcon>
+
+#include "exifscanner.h"
 
 #include <exiv2/image.hpp>
 #include <exiv2/exif.hpp>
 #include <exiv2/tags.hpp>
 
 
+class PhotoFile;
+class ThumbnailStore;
+
+class PhotoData : public QSharedData
+{
+  public:
+    PhotoData(const QString &filename, const QDateTime &timestamp, const qreal gpsLat, const qreal gpsLong)
+      : QSharedData(), m_timestamp(timestamp), m_gpsLat(gpsLat), m_gpsLong(gpsLong), m_filename(filename),
+        m_thumbnailStore(0)
+    {
+    }
+
+    QDateTime m_timestamp;
+    qreal m_gpsLat;
+    qreal m_gpsLong;
+    QString m_filename;
+    // the thumbnail itself is kept by the store, to limit the memory used for it
+    ThumbnailStore *m_thumbnailStore;
+};
 
+/**
+ * A photo and its metadata.
+ *
+ * Photos are implicitly shared: copies, for example in a QVariant or in a
+ * queue between threads, only share the data and cost a reference count.
+ * The data is read-only after the photo has been handed on, the only setter
+ * detaches the photo if it is shared.
+ */
 class Photo
 {
   public:
     Photo(const QString &path = 0);
-    inline bool isGeoTagged() const { return ((m_gpsLat != -1) && (m_gpsLong != -1)); }
+    explicit Photo(const PhotoFile &file);
+    Photo(const QString &path, const QDateTime &timestamp, const qreal gpsLat, const qreal gpsLong);
+    inline bool isGeoTagged() const { return ((d->m_gpsLat != -1) && (d->m_gpsLong != -1)); }
     QImage getImage() const;
     QPixmap getPixmap() const;
-    QImage getThumbnailImage() const;
-    QPixmap getThumbnailPixmap() const;
-    inline QIcon getIcon() const { return QIcon(getThumbnailPixmap()); }
-    inline qreal getGpsLat() const { return m_gpsLat; }
-    inline qreal getGpsLong() const { return m_gpsLong; }
-    inline QDateTime getTimestamp() const { return m_timestamp; }
-    inline QString getFilename() const { return m_filename; }
+    QImage getThumbnailImage(const QSize &size) const;
+    QPixmap getThumbnailPixmap(const QSize &size) const;
+    inline void setThumbnailStore(ThumbnailStore *thumbnailStore) { d->m_thumbnailStore = thumbnailStore; }
+    inline qreal getGpsLat() const { return d->m_gpsLat; }
+    inline qreal getGpsLong() const { return d->m_gpsLong; }
+    inline QDateTime getTimestamp() const { return d->m_timestamp; }
+    inline QString getFilename() const { return d->m_filename; }
 
   private:
-    static bool exivHasKey(const QString &key, Exiv2::ExifData &data);
-    static qreal convertToCoordinate(const QString &coord, const QString &ref);
+    void readMetadata(const ExifScanner::Result result, const ExifScanner &scanner);
+    void readMetadataWithExiv2(Exiv2::Image &image);
+    static qreal convertToCoordinate(const Exiv2::Exifdatum &coord, const Exiv2::Exifdatum &ref);
 
-    QDateTime m_timestamp;
-    qreal m_gpsLat;
-    qreal m_gpsLong;
-    QString m_filename;
-    mutable QImage m_thumbnail;
+    QSharedDataPointer<PhotoData> d;
 };
 
 Q_DECLARE_METATYPE(Photo)
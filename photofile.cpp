@@ -0,0 +1,146 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "photofile.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#ifdef Q_OS_LINUX
+#include <sys/vfs.h>
+#endif
+
+PhotoFile::PhotoFile()
+  : m_filename(), m_file(), m_buffer(), m_data(0), m_size(0)
+{
+}
+
+PhotoFile::~PhotoFile()
+{
+  if (m_file.isOpen())
+    m_file.close(); // also unmaps the file
+}
+
+bool PhotoFile::open(const QString &filename)
+{
+  m_filename = filename;
+  m_file.setFileName(filename);
+  if (!m_file.open(QIODevice::ReadOnly))
+    return false;
+
+  m_size = m_file.size();
+
+  if (!isOnNetworkFileSystem(filename))
+  {
+    m_data = m_file.map(0, m_size);
+  }
+
+  if (!m_data)
+  {
+    m_buffer = m_file.readAll();
+    m_file.close();
+    m_size = m_buffer.size();
+    m_data = reinterpret_cast<const uchar*>(m_buffer.constData());
+  }
+
+  IoStatistics::addBytes(IoStatistics::SharedStage, m_size);
+  return (m_size > 0);
+}
+
+// takes over contents which were already read by someone else, for example the ImportReader
+void PhotoFile::setContents(const QString &filename, const QByteArray &contents)
+{
+  if (m_file.isOpen())
+    m_file.close();
+
+  m_filename = filename;
+  m_buffer = contents;
+  m_size = m_buffer.size();
+  m_data = m_size > 0 ? reinterpret_cast<const uchar*>(m_buffer.constData()) : 0;
+}
+
+/*
+ * Pages of mapped files on network file systems may be fetched several times,
+ * one large read is more predictable there.
+ */
+bool PhotoFile::isOnNetworkFileSystem(const QString &filename)
+{
+#ifdef Q_OS_LINUX
+  struct statfs buffer;
+  if (statfs(QFile::encodeName(filename).constData(), &buffer) != 0)
+    return true;
+
+  switch (static_cast<unsigned long>(buffer.f_type))
+  {
+    case 0x6969:      // NFS
+    case 0x517B:      // SMB
+    case 0xFF534D42:  // CIFS
+    case 0xFE534D42:  // SMB2
+    case 0x65735546:  // FUSE, for example sshfs
+      return true;
+    default:
+      return false;
+  }
+#else
+  Q_UNUSED(filename);
+  return false;
+#endif
+}
+
+static QMutex ioStatisticsMutex;
+static qint64 ioStatisticsBytes[IoStatistics::StageCount] = { 0, 0, 0 };
+
+void IoStatistics::addBytes(const Stage stage, const qint64 bytes)
+{
+  QMutexLocker locker(&ioStatisticsMutex);
+  ioStatisticsBytes[stage] += bytes;
+}
+
+qint64 IoStatistics::bytes(const Stage stage)
+{
+  QMutexLocker locker(&ioStatisticsMutex);
+  return ioStatisticsBytes[stage];
+}
+
+qint64 IoStatistics::totalBytes()
+{
+  QMutexLocker locker(&ioStatisticsMutex);
+  qint64 total = 0;
+  for (int i = 0; i < StageCount; ++i)
+  {
+    total += ioStatisticsBytes[i];
+  }
+  return total;
+}
+
+void IoStatistics::reset()
+{
+  QMutexLocker locker(&ioStatisticsMutex);
+  for (int i = 0; i < StageCount; ++i)
+  {
+    ioStatisticsBytes[i] = 0;
+  }
+}
+
+QString IoStatistics::summary()
+{
+  QMutexLocker locker(&ioStatisticsMutex);
+  return QString::fromLatin1("metadata: %1 KB, thumbnails: %2 KB, shared: %3 KB")
+         .arg(ioStatisticsBytes[MetadataStage] / 1024)
+         .arg(ioStatisticsBytes[ThumbnailStage] / 1024)
+         .arg(ioStatisticsBytes[SharedStage] / 1024);
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHOTOFILE_H
+#define PHOTOFILE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+/**
+ * The contents of a photo file in memory.
+ *
+ * Local files are mapped into memory, files on network file systems are
+ * read with a single buffered read. The same bytes are then handed to the
+ * EXIF parser and to the image decoder. During the import it only holds the
+ * start of the file which the ImportReader read for the EXIF parser.
+ */
+class PhotoFile
+{
+  public:
+    PhotoFile();
+    ~PhotoFile();
+
+    bool open(const QString &filename);
+    void setContents(const QString &filename, const QByteArray &contents);
+    inline bool isOpen() const { return m_data != 0; }
+    inline const uchar *data() const { return m_data; }
+    inline qint64 size() const { return m_size; }
+    inline QString getFilename() const { return m_filename; }
+
+  private:
+    static bool isOnNetworkFileSystem(const QString &filename);
+
+    QString m_filename;
+    QFile m_file;
+    QByteArray m_buffer;
+    const uchar *m_data;
+    qint64 m_size;
+
+  private:
+    Q_DISABLE_COPY(PhotoFile)
+};
+
+/**
+ * Counts the bytes read from photo files, per stage of the import.
+ */
+class IoStatistics
+{
+  public:
+    enum Stage
+    {
+      MetadataStage,   // the start of the files, for their EXIF data
+      ThumbnailStage,  // previews and images decoded from a file name
+      SharedStage,     // whole files read through PhotoFile
+      StageCount
+    };
+
+    static void addBytes(const Stage stage, const qint64 bytes);
+    static qint64 bytes(const Stage stage);
+    static qint64 totalBytes();
+    static void reset();
+    static QString summary();
+};
+
+#endif
@@ -0,0 +1,443 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "photomodel.h"
+#include "photomodel.moc"
+#include "roles.h"
+#include "thumbnailstore.h"
+
+#include <QPair>
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <limits>
+
+// photos without a timestamp are sorted in front of all others
+static const qint64 InvalidTimestamp = std::numeric_limits<qint64>::min();
+static const qint64 MillisecondsPerDay = 24 * 60 * 60 * 1000;
+
+// below this size, sorting takes less time than starting the threads
+static const int ParallelSortSize = 16384;
+
+struct SortEntry
+{
+  qint64 key;
+  int index;
+
+  // the index keeps photos with the same timestamp in their original order
+  bool operator<(const SortEntry &other) const
+  {
+    return (key < other.key) || ((key == other.key) && (index < other.index));
+  }
+};
+
+typedef QPair<SortEntry*, SortEntry*> SortRange;
+
+static void sortRange(SortRange &range)
+{
+  std::sort(range.first, range.second);
+}
+
+// sorts parts of the entries in separate threads and merges them afterwards
+static void sortEntries(QVector<SortEntry> &entries)
+{
+  const int chunkCount = (entries.size() < ParallelSortSize) ? 1 : qMax(QThread::idealThreadCount(), 1);
+  SortEntry * const begin = entries.data();
+  if (chunkCount == 1)
+  {
+    std::sort(begin, begin + entries.size());
+    return;
+  }
+
+  QList<SortRange> ranges;
+  for (int chunk = 0; chunk < chunkCount; ++chunk)
+  {
+    ranges << SortRange(begin + qint64(entries.size()) * chunk / chunkCount,
+                        begin + qint64(entries.size()) * (chunk + 1) / chunkCount);
+  }
+  QtConcurrent::blockingMap(ranges, sortRange);
+
+  for (int chunk = 1; chunk < chunkCount; ++chunk)
+  {
+    std::inplace_merge(begin, ranges.at(chunk).first, ranges.at(chunk).second);
+  }
+}
+
+// drops the given rows, which have to be sorted, and moves the others together in one pass
+template<class T> static void removeSortedRows(QVector<T> &values, const QList<int> &sortedRows)
+{
+  QList<int>::const_iterator removed = sortedRows.constBegin();
+  int kept = *removed;
+  for (int row = kept; row < values.size(); ++row)
+  {
+    if ((removed != sortedRows.constEnd()) && (*removed == row))
+    {
+      ++removed;
+      continue;
+    }
+
+    values[kept++] = values.at(row);
+  }
+  values.resize(kept);
+}
+
+// shown until the thumbnail has been loaded, so that the rows do not change their layout
+static QImage placeholderImage(const QSize &size)
+{
+  QImage image(size, QImage::Format_ARGB32_Premultiplied);
+  image.fill(0);
+  return image;
+}
+
+PhotoModel::PhotoModel(QObject *parent)
+  : QAbstractListModel(parent), m_thumbnailStore(0), m_decorationSize(64, 64),
+    m_placeholder(placeholderImage(m_decorationSize)), m_missingThumbnails(), m_ids(), m_latitudes(), m_longitudes(),
+    m_timestamps(), m_directoryIds(), m_nameOffsets(), m_nameLengths(), m_selected(), m_directories(),
+    m_directoryIndex(), m_names(), m_usedNameLength(0), m_nextId(0)
+{
+}
+
+void PhotoModel::setThumbnailStore(ThumbnailStore *thumbnailStore)
+{
+  m_thumbnailStore = thumbnailStore;
+}
+
+void PhotoModel::setDecorationSize(const QSize &size)
+{
+  m_decorationSize = size;
+  m_placeholder = placeholderImage(size);
+}
+
+// called when a thumbnail has been loaded, the row which showed the placeholder is updated
+void PhotoModel::thumbnailCreated(const QString &filename)
+{
+  const QHash<QString, int>::iterator it = m_missingThumbnails.find(filename);
+  if (it == m_missingThumbnails.end())
+    return;
+
+  // after the rows were moved around the views ask again anyway:
+  const int row = *it;
+  m_missingThumbnails.erase(it);
+  if ((row < m_timestamps.size()) && (this->filename(row) == filename))
+  {
+    const QModelIndex changed = index(row, 0);
+    emit(dataChanged(changed, changed));
+  }
+}
+
+qint64 PhotoModel::timestampKey(const QDateTime &timestamp)
+{
+  if (!timestamp.isValid())
+    return InvalidTimestamp;
+
+  // toTime_t() can not represent dates before 1970, the Julian day counts from 4713 BC:
+  return qint64(timestamp.date().toJulianDay()) * MillisecondsPerDay + QTime(0, 0).msecsTo(timestamp.time());
+}
+
+int PhotoModel::rowCount(const QModelIndex &parent) const
+{
+  if (parent.isValid())
+    return 0;
+
+  return m_timestamps.size();
+}
+
+QVariant PhotoModel::data(const QModelIndex &index, int role) const
+{
+  if (!index.isValid() || (index.row() >= m_timestamps.size()))
+    return QVariant();
+
+  const int row = index.row();
+  switch (role)
+  {
+    case Qt::DisplayRole:
+      return timestamp(row).toString();
+
+    case Qt::ToolTipRole:
+      return filename(row);
+
+    case Qt::DecorationRole:
+      // the file name is the key of the thumbnail, missing thumbnails are loaded in the background:
+      if (m_thumbnailStore)
+      {
+        const QString name = filename(row);
+        const QImage thumbnail = m_thumbnailStore->thumbnail(name, m_decorationSize);
+        if (!thumbnail.isNull())
+          return thumbnail;
+
+        m_missingThumbnails.insert(name, row);
+        return m_placeholder;
+      }
+      break;
+
+    case PhotoRole:
+      return QVariant::fromValue(photo(row));
+
+    case TimestampRole:
+      return timestamp(row);
+
+    case SelectedRole:
+      return m_selected.testBit(row);
+
+    default:
+      break;
+  }
+
+  return QVariant();
+}
+
+bool PhotoModel::setData(const QModelIndex &index, const QVariant &value, int role)
+{
+  if (!index.isValid() || (index.row() >= m_timestamps.size()) || (role != SelectedRole))
+    return false;
+
+  m_selected.setBit(index.row(), value.toBool());
+  emit(dataChanged(index, index));
+  return true;
+}
+
+bool PhotoModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+  if (parent.isValid() || (row < 0) || (count <= 0) || (row + count > m_timestamps.size()))
+    return false;
+
+  beginRemoveRows(QModelIndex(), row, row + count - 1);
+
+  for (int i = row; i < row + count; ++i)
+  {
+    m_usedNameLength -= m_nameLengths.at(i);
+  }
+
+  m_ids.remove(row, count);
+  m_latitudes.remove(row, count);
+  m_longitudes.remove(row, count);
+  m_timestamps.remove(row, count);
+  m_directoryIds.remove(row, count);
+  m_nameOffsets.remove(row, count);
+  m_nameLengths.remove(row, count);
+
+  const int newSize = m_selected.size() - count;
+  for (int i = row; i < newSize; ++i)
+  {
+    m_selected.setBit(i, m_selected.testBit(i + count));
+  }
+  m_selected.resize(newSize);
+
+  // the names of removed rows stay in the shared string until enough of them piled up:
+  if (m_names.size() > 2 * m_usedNameLength + 4096)
+    compactNames();
+
+  endRemoveRows();
+  return true;
+}
+
+/*
+ * Adds the photos at their place in the timestamp order. The photos are
+ * sorted by a precomputed key, then every run of them which falls between
+ * the same two existing rows is inserted with one rowsInserted. The runs
+ * are inserted from the last to the first, so that the rows in front of the
+ * runs still to come do not move. Usually all photos belong behind the
+ * existing rows, which is a single run.
+ */
+void PhotoModel::addPhotos(const QList<Photo> &photos)
+{
+  if (photos.isEmpty())
+    return;
+
+  QVector<SortEntry> entries(photos.size());
+  for (int i = 0; i < photos.size(); ++i)
+  {
+    entries[i].key = timestampKey(photos.at(i).getTimestamp());
+    entries[i].index = i;
+  }
+  sortEntries(entries);
+
+  QList<Photo> sortedPhotos;
+  QVector<qint64> keys(entries.size());
+  for (int i = 0; i < entries.size(); ++i)
+  {
+    sortedPhotos << photos.at(entries.at(i).index);
+    keys[i] = entries.at(i).key;
+  }
+
+  int end = keys.size();
+  while (end > 0)
+  {
+    // new photos go behind the existing rows with the same timestamp:
+    const int row = std::upper_bound(m_timestamps.constBegin(), m_timestamps.constEnd(), keys.at(end - 1)) - m_timestamps.constBegin();
+    int start = end - 1;
+    while ((start > 0) && ((row == 0) || (keys.at(start - 1) >= m_timestamps.at(row - 1))))
+      --start;
+
+    insertPhotos(row, sortedPhotos.mid(start, end - start), keys.mid(start, end - start));
+    end = start;
+  }
+}
+
+// inserts sorted photos in front of the given row, they have to belong there in the timestamp order
+void PhotoModel::insertPhotos(const int row, const QList<Photo> &photos, const QVector<qint64> &keys)
+{
+  const int count = photos.size();
+  beginInsertRows(QModelIndex(), row, row + count - 1);
+
+  m_ids.insert(row, count, 0);
+  m_latitudes.insert(row, count, 0);
+  m_longitudes.insert(row, count, 0);
+  m_timestamps.insert(row, count, 0);
+  m_directoryIds.insert(row, count, 0);
+  m_nameOffsets.insert(row, count, 0);
+  m_nameLengths.insert(row, count, 0);
+
+  const int oldSize = m_selected.size();
+  m_selected.resize(oldSize + count);
+  for (int i = oldSize - 1; i >= row; --i)
+  {
+    m_selected.setBit(i + count, m_selected.testBit(i));
+  }
+  m_selected.fill(false, row, row + count);
+
+  for (int i = 0; i < count; ++i)
+  {
+    const Photo &photo = photos.at(i);
+    const QString path = photo.getFilename();
+    const int nameStart = path.lastIndexOf(QLatin1Char('/')) + 1;
+
+    m_ids[row + i] = m_nextId++;
+    m_latitudes[row + i] = photo.getGpsLat();
+    m_longitudes[row + i] = photo.getGpsLong();
+    m_timestamps[row + i] = keys.at(i);
+    m_directoryIds[row + i] = internDirectory(path.left(nameStart));
+    m_nameOffsets[row + i] = m_names.size();
+    m_nameLengths[row + i] = path.size() - nameStart;
+
+    m_names.append(path.midRef(nameStart));
+    m_usedNameLength += path.size() - nameStart;
+  }
+
+  endInsertRows();
+}
+
+/*
+ * Removes the given rows, which do not have to be sorted or contiguous. A
+ * single range is removed with rowsRemoved, otherwise the remaining rows are
+ * compacted in one pass and views see a reset.
+ */
+void PhotoModel::removePhotos(const QList<int> &rows)
+{
+  QList<int> sortedRows = rows;
+  qSort(sortedRows);
+  sortedRows.erase(std::unique(sortedRows.begin(), sortedRows.end()), sortedRows.end());
+  sortedRows.erase(sortedRows.begin(), std::lower_bound(sortedRows.begin(), sortedRows.end(), 0));
+  sortedRows.erase(std::lower_bound(sortedRows.begin(), sortedRows.end(), m_timestamps.size()), sortedRows.end());
+  if (sortedRows.isEmpty())
+    return;
+
+  if (sortedRows.last() - sortedRows.first() + 1 == sortedRows.size())
+  {
+    removeRows(sortedRows.first(), sortedRows.size());
+    return;
+  }
+
+  emit(rowsAboutToBeCompacted(sortedRows));
+  beginResetModel();
+  compactRows(sortedRows);
+  endResetModel();
+}
+
+void PhotoModel::compactRows(const QList<int> &sortedRows)
+{
+  for (QList<int>::const_iterator it = sortedRows.constBegin(); it!=sortedRows.constEnd(); ++it)
+  {
+    m_usedNameLength -= m_nameLengths.at(*it);
+  }
+
+  removeSortedRows(m_ids, sortedRows);
+  removeSortedRows(m_latitudes, sortedRows);
+  removeSortedRows(m_longitudes, sortedRows);
+  removeSortedRows(m_timestamps, sortedRows);
+  removeSortedRows(m_directoryIds, sortedRows);
+  removeSortedRows(m_nameOffsets, sortedRows);
+  removeSortedRows(m_nameLengths, sortedRows);
+
+  QList<int>::const_iterator removed = sortedRows.constBegin();
+  int kept = *removed;
+  for (int row = kept; row < m_selected.size(); ++row)
+  {
+    if ((removed != sortedRows.constEnd()) && (*removed == row))
+    {
+      ++removed;
+      continue;
+    }
+
+    m_selected.setBit(kept++, m_selected.testBit(row));
+  }
+  m_selected.resize(kept);
+
+  // the rows of the missing thumbnails changed, the views ask again after the reset:
+  m_missingThumbnails.clear();
+
+  if (m_names.size() > 2 * m_usedNameLength + 4096)
+    compactNames();
+}
+
+Photo PhotoModel::photo(const int row) const
+{
+  Photo result(filename(row), timestamp(row), m_latitudes.at(row), m_longitudes.at(row));
+  result.setThumbnailStore(m_thumbnailStore);
+  return result;
+}
+
+QString PhotoModel::filename(const int row) const
+{
+  return m_directories.at(m_directoryIds.at(row)) + m_names.mid(m_nameOffsets.at(row), m_nameLengths.at(row));
+}
+
+QDateTime PhotoModel::timestamp(const int row) const
+{
+  const qint64 key = m_timestamps.at(row);
+  if (key == InvalidTimestamp)
+    return QDateTime();
+
+  const qint64 day = key / MillisecondsPerDay;
+  return QDateTime(QDate::fromJulianDay(int(day)), QTime(0, 0).addMSecs(int(key - day * MillisecondsPerDay)));
+}
+
+int PhotoModel::internDirectory(const QString &directory)
+{
+  const QHash<QString, int>::const_iterator it = m_directoryIndex.constFind(directory);
+  if (it != m_directoryIndex.constEnd())
+    return *it;
+
+  const int id = m_directories.size();
+  m_directories << directory;
+  m_directoryIndex.insert(directory, id);
+  return id;
+}
+
+void PhotoModel::compactNames()
+{
+  QString names;
+  names.reserve(m_usedNameLength);
+  for (int row = 0; row < m_nameOffsets.size(); ++row)
+  {
+    const int offset = names.size();
+    names.append(m_names.midRef(m_nameOffsets.at(row), m_nameLengths.at(row)));
+    m_nameOffsets[row] = offset;
+  }
+  m_names = names;
+}
@@ -0,0 +1,129 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHOTOMODEL_H
+#define PHOTOMODEL_H
+
+#include <QAbstractListModel>
+#include <QBitArray>
+#include <QDateTime>
+#include <QHash>
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "photo.h"
+
+class ThumbnailStore;
+
+/**
+ * Model of the loaded photos.
+ *
+ * The photos are not kept as objects, every property has its own array
+ * which is indexed by the row: the coordinates, the timestamp as
+ * milliseconds since the start of the Julian calendar, so that any date
+ * fits, and the file name, split into an interned
+ * directory and the name itself, which is kept in one large string shared
+ * by all rows. A row costs a few dozen bytes this way, and the loops which
+ * only look at the coordinates or the timestamps run over contiguous
+ * memory. The roles of roles.h are served from these arrays, PhotoRole
+ * creates a Photo on the fly. Every photo also gets an id which stays the
+ * same while the rows are moved around.
+ *
+ * The rows are always sorted by their timestamp. New photos are sorted on
+ * their own and then inserted at their place, views see one rowsInserted
+ * for every run of them which falls between the same two existing rows.
+ * A single range of rows is removed with rowsRemoved. Rows which are spread
+ * over the model are removed by compacting the remaining rows in one pass,
+ * which views see as a reset. rowsAboutToBeCompacted() tells which rows are
+ * removed before that, so that the map can remove their markers.
+ *
+ * The decoration is fetched from the ThumbnailStore whenever a view asks
+ * for it, in the thumbnail level which fits the icon size of the view. If
+ * the store does not have the thumbnail in memory, an empty placeholder is
+ * returned and the row is remembered, thumbnailCreated() then tells the
+ * views about it with dataChanged once the thumbnail has been loaded.
+ */
+class PhotoModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+  public:
+    PhotoModel(QObject *parent = 0);
+
+    void setThumbnailStore(ThumbnailStore *thumbnailStore);
+    void setDecorationSize(const QSize &size);
+    void thumbnailCreated(const QString &filename);
+
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    virtual bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole);
+    virtual bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex());
+
+    void addPhotos(const QList<Photo> &photos);
+    void removePhotos(const QList<int> &rows);
+
+    Photo photo(const int row) const;
+    inline int photoId(const int row) const { return m_ids.at(row); }
+    QString filename(const int row) const;
+    QDateTime timestamp(const int row) const;
+    inline qint64 timestampKey(const int row) const { return m_timestamps.at(row); }
+    inline qreal latitude(const int row) const { return m_latitudes.at(row); }
+    inline qreal longitude(const int row) const { return m_longitudes.at(row); }
+
+    static qint64 timestampKey(const QDateTime &timestamp);
+
+  signals:
+    void rowsAboutToBeCompacted(const QList<int> &rows);
+
+  private:
+    void insertPhotos(const int row, const QList<Photo> &photos, const QVector<qint64> &keys);
+    void compactRows(const QList<int> &sortedRows);
+    int internDirectory(const QString &directory);
+    void compactNames();
+
+    ThumbnailStore *m_thumbnailStore;
+    QSize m_decorationSize;
+    QImage m_placeholder;
+    // rows which asked for a thumbnail that was not in memory, by file name:
+    mutable QHash<QString, int> m_missingThumbnails;
+
+    // one entry per row:
+    QVector<int> m_ids;
+    QVector<qreal> m_latitudes;
+    QVector<qreal> m_longitudes;
+    QVector<qint64> m_timestamps;
+    QVector<int> m_directoryIds;
+    QVector<int> m_nameOffsets;
+    QVector<int> m_nameLengths;
+    QBitArray m_selected;
+
+    // shared by all rows:
+    QStringList m_directories;
+    QHash<QString, int> m_directoryIndex;
+    QString m_names;
+    int m_usedNameLength;
+    int m_nextId;
+
+  private:
+    Q_DISABLE_COPY(PhotoModel)
+};
+
+#endif
@@ -0,0 +1,232 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "thumbnailcache.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QTemporaryFile>
+
+#ifdef Q_OS_UNIX
+#include <cstdio>
+#include <utime.h>
+#endif
+
+const quint32 ThumbnailCacheMagic = 0x54525448; // "TRTH"
+const quint32 ThumbnailCacheVersion = 2;
+const int ThumbnailCacheQuality = 90;
+// after an expiry the cache is trimmed a bit further to avoid expiring on every store:
+const qreal ThumbnailCacheExpireTarget = 0.9;
+const char ThumbnailCacheEntryPattern[] = "*.thumb";
+const char ThumbnailCacheTemporaryPattern[] = "entry.*";
+// temporary files older than this were left behind by a crash, younger ones may still be written to:
+const int ThumbnailCacheTemporaryMaximumAge = 10 * 60;
+
+ThumbnailCache::ThumbnailCache(const QString &directory, const qint64 sizeBudget)
+  : m_directory(directory), m_sizeBudget(sizeBudget), m_currentSize(0), m_mutex()
+{
+  QDir().mkpath(m_directory);
+
+  const QDateTime staleTime = QDateTime::currentDateTime().addSecs(-ThumbnailCacheTemporaryMaximumAge);
+  const QFileInfoList temporaryFiles = QDir(m_directory).entryInfoList(QStringList(QLatin1String(ThumbnailCacheTemporaryPattern)), QDir::Files);
+  for (QFileInfoList::const_iterator it = temporaryFiles.constBegin(); it!=temporaryFiles.constEnd(); ++it)
+  {
+    if (it->lastModified() < staleTime)
+      QFile::remove(it->filePath());
+  }
+
+  const QFileInfoList entries = QDir(m_directory).entryInfoList(QStringList(QLatin1String(ThumbnailCacheEntryPattern)), QDir::Files);
+  for (QFileInfoList::const_iterator it = entries.constBegin(); it!=entries.constEnd(); ++it)
+  {
+    m_currentSize += it->size();
+  }
+
+  expire();
+}
+
+QString ThumbnailCache::entryPath(const QString &canonicalPath) const
+{
+  const QByteArray hash = QCryptographicHash::hash(QFile::encodeName(canonicalPath), QCryptographicHash::Md5);
+  return m_directory + QLatin1Char('/') + QString::fromLatin1(hash.toHex()) + QLatin1String(".thumb");
+}
+
+/*
+ * Opens the entry for the given photo and checks that it is still valid.
+ * On success the file is positioned at the thumbnail data.
+ */
+bool ThumbnailCache::openEntry(const QFileInfo &info, QFile *file) const
+{
+  const QString canonicalPath = info.canonicalFilePath();
+  if (canonicalPath.isEmpty())
+    return false;
+
+  file->setFileName(entryPath(canonicalPath));
+  if (!file->open(QIODevice::ReadOnly))
+    return false;
+
+  QDataStream stream(file);
+  stream.setVersion(QDataStream::Qt_4_5);
+  quint32 magic = 0;
+  quint32 version = 0;
+  QString path;
+  qint64 size = 0;
+  qint64 modified = 0;
+  stream >> magic >> version;
+  if ((magic != ThumbnailCacheMagic) || (version != ThumbnailCacheVersion))
+    return false;
+
+  stream >> path >> size >> modified;
+  if ((stream.status() != QDataStream::Ok) ||
+      (path != canonicalPath) || (size != info.size()) || (modified != info.lastModified().toTime_t()))
+  {
+    // stale or broken entry, it will be replaced by the next store()
+    return false;
+  }
+
+  return true;
+}
+
+// only reads the header of the entry, the thumbnail is not decoded
+bool ThumbnailCache::contains(const QFileInfo &info) const
+{
+  QFile file;
+  return openEntry(info, &file);
+}
+
+// returns the levels of the thumbnail as stored, without decoding them
+QList<QByteArray> ThumbnailCache::loadLevels(const QFileInfo &info) const
+{
+  QFile file;
+  if (!openEntry(info, &file))
+    return QList<QByteArray>();
+
+  QDataStream stream(&file);
+  stream.setVersion(QDataStream::Qt_4_5);
+  QList<QByteArray> levels;
+  stream >> levels;
+  if (stream.status() != QDataStream::Ok)
+    return QList<QByteArray>();
+
+  // the modification time of an entry is its last use, expire() removes the oldest ones first:
+#ifdef Q_OS_UNIX
+  ::utime(QFile::encodeName(file.fileName()).constData(), 0);
+#endif
+
+  return levels;
+}
+
+QByteArray ThumbnailCache::encode(const QImage &thumbnail)
+{
+  QByteArray data;
+  QBuffer buffer(&data);
+  buffer.open(QIODevice::WriteOnly);
+  if (!thumbnail.save(&buffer, "JPEG", ThumbnailCacheQuality))
+    return QByteArray();
+
+  return data;
+}
+
+// stores the levels of a thumbnail, which were encoded with encode()
+void ThumbnailCache::storeLevels(const QFileInfo &info, const QList<QByteArray> &levels)
+{
+  const QString canonicalPath = info.canonicalFilePath();
+  if (canonicalPath.isEmpty() || levels.isEmpty())
+    return;
+
+  // write to a temporary file in the same directory first, then move it into place:
+  QTemporaryFile temporaryFile(m_directory + QLatin1String("/entry.XXXXXX"));
+  temporaryFile.setAutoRemove(false);
+  if (!temporaryFile.open())
+    return;
+
+  QDataStream stream(&temporaryFile);
+  stream.setVersion(QDataStream::Qt_4_5);
+  stream << ThumbnailCacheMagic << ThumbnailCacheVersion;
+  stream << canonicalPath << qint64(info.size()) << qint64(info.lastModified().toTime_t()) << levels;
+  const qint64 entrySize = temporaryFile.size();
+  const QString temporaryPath = temporaryFile.fileName();
+  temporaryFile.close();
+
+  if (stream.status() != QDataStream::Ok)
+  {
+    QFile::remove(temporaryPath);
+    return;
+  }
+
+  const QString targetPath = entryPath(canonicalPath);
+  bool needsExpiry = false;
+  {
+    // the entry which is replaced is only counted once if two threads store the same photo:
+    QMutexLocker locker(&m_mutex);
+    const qint64 oldSize = QFileInfo(targetPath).size();
+#ifdef Q_OS_UNIX
+    // rename() replaces an existing entry atomically
+    const bool renamed = (::rename(QFile::encodeName(temporaryPath).constData(), QFile::encodeName(targetPath).constData()) == 0);
+#else
+    QFile::remove(targetPath);
+    const bool renamed = QFile::rename(temporaryPath, targetPath);
+#endif
+    if (!renamed)
+    {
+      QFile::remove(temporaryPath);
+      return;
+    }
+
+    m_currentSize += entrySize - oldSize;
+    needsExpiry = (m_currentSize > m_sizeBudget);
+  }
+
+  if (needsExpiry)
+    expire();
+}
+
+/*
+ * Removes the least recently used entries until the cache fits into its size
+ * budget again.
+ */
+void ThumbnailCache::expire()
+{
+  QMutexLocker locker(&m_mutex);
+
+  if (m_currentSize <= m_sizeBudget)
+    return;
+
+  const QFileInfoList entries = QDir(m_directory).entryInfoList(QStringList(QLatin1String(ThumbnailCacheEntryPattern)), QDir::Files);
+  QMultiMap<QDateTime, QFileInfo> entriesByAge;
+  m_currentSize = 0;
+  for (QFileInfoList::const_iterator it = entries.constBegin(); it!=entries.constEnd(); ++it)
+  {
+    entriesByAge.insert(it->lastModified(), *it);
+    m_currentSize += it->size();
+  }
+
+  const qint64 targetSize = qint64(m_sizeBudget * ThumbnailCacheExpireTarget);
+  for (QMultiMap<QDateTime, QFileInfo>::const_iterator it = entriesByAge.constBegin();
+       (it!=entriesByAge.constEnd()) && (m_currentSize > targetSize); ++it)
+  {
+    if (QFile::remove(it.value().filePath()))
+      m_currentSize -= it.value().size();
+  }
+}
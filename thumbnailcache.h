@@ -0,0 +1,69 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+/**
+ * Persistent on-disk cache for thumbnails.
+ *
+ * There is one file per photo, named after the MD5 hash of the canonical
+ * path. The entries use Trippy's own format, a QDataStream with a small
+ * header followed by the JPEG data of all levels of the thumbnail pyramid,
+ * and cannot be shared with other applications. Each entry stores the path,
+ * size and modification time of the photo it was created from and is only
+ * used if they still match. New entries are written to a temporary file
+ * first and then renamed, so that several threads can store thumbnails at
+ * the same time. Temporary files left behind by a crash are removed when the
+ * cache is opened. Loading an entry sets its modification time to the current
+ * time, so when the cache grows beyond its size budget the least recently
+ * used entries are removed.
+ */
+class ThumbnailCache
+{
+  public:
+    ThumbnailCache(const QString &directory, const qint64 sizeBudget);
+
+    bool contains(const QFileInfo &info) const;
+    QList<QByteArray> loadLevels(const QFileInfo &info) const;
+    void storeLevels(const QFileInfo &info, const QList<QByteArray> &levels);
+    void expire();
+
+    static QByteArray encode(const QImage &thumbnail);
+
+  private:
+    QString entryPath(const QString &canonicalPath) const;
+    bool openEntry(const QFileInfo &info, QFile *file) const;
+
+    QString m_directory;
+    qint64 m_sizeBudget;
+    qint64 m_currentSize;
+    QMutex m_mutex;
+
+  private:
+    Q_DISABLE_COPY(ThumbnailCache)
+};
+
+#endif
@@ -0,0 +1,201 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "thumbnailloader.h"
+#include "exifscanner.h"
+#include "imagescaler.h"
+#include "jpegdecoder.h"
+#include "photofile.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+
+// previews with a different aspect ratio are letterboxed, do not use them:
+const qreal ThumbnailAspectRatioTolerance = 0.02;
+// the frame header of a preview is normally within its first few KB:
+const qint64 PreviewHeaderInitialRead = 4 * 1024;
+
+QImage ThumbnailLoader::load(const QString &filename, const QSize &size)
+{
+  const QImage preview = loadEmbeddedPreview(filename, size);
+  if (!preview.isNull())
+    return preview;
+
+  return loadFullImage(filename, size);
+}
+
+/*
+ * Same as above, but works on a file which has already been read into memory.
+ */
+QImage ThumbnailLoader::load(const PhotoFile &file, const QSize &size)
+{
+  const QImage preview = loadEmbeddedPreview(file, size);
+  if (!preview.isNull())
+    return preview;
+
+  QImage image = JpegDecoder::decodeScaled(file.data(), file.size(), size);
+  if (image.isNull())
+    image.loadFromData(file.data(), file.size());
+
+  return ImageScaler::scaled(image, size);
+}
+
+/*
+ * Checks whether a preview is big enough and has the same aspect ratio as
+ * the image.
+ */
+bool ThumbnailLoader::isUsablePreview(const QSize &previewSize, const QSize &imageSize, const QSize &size, qint64 *pixels)
+{
+  if (previewSize.isEmpty())
+    return false;
+
+  // the thumbnail must not be smaller than what we would get from the full image:
+  const QSize neededSize = imageSize.scaled(size, Qt::KeepAspectRatio);
+  if ((previewSize.width() < neededSize.width()) || (previewSize.height() < neededSize.height()))
+    return false;
+
+  const qreal imageAspectRatio = qreal(imageSize.width()) / imageSize.height();
+  const qreal previewAspectRatio = qreal(previewSize.width()) / previewSize.height();
+  if (qAbs(previewAspectRatio - imageAspectRatio) > ThumbnailAspectRatioTolerance * imageAspectRatio)
+    return false;
+
+  *pixels = qint64(previewSize.width()) * previewSize.height();
+  return true;
+}
+
+/*
+ * Reads the size of a preview from its frame header. Only the start of the
+ * preview is read, more of it only if the frame header is further in.
+ */
+QSize ThumbnailLoader::readPreviewSize(QFile &file, const qint64 offset, const quint32 length)
+{
+  if (!file.seek(offset))
+    return QSize();
+
+  QByteArray header = file.read(qMin(qint64(length), PreviewHeaderInitialRead));
+  ExifScanner scanner;
+  ExifScanner::Result result = scanner.scan(reinterpret_cast<const uchar*>(header.constData()), header.size(), ExifScanner::ScanImageSize);
+  while ((result == ExifScanner::Truncated) && (scanner.requiredSize() <= length))
+  {
+    const QByteArray more = file.read(scanner.requiredSize() - header.size());
+    if (more.isEmpty())
+      break;
+
+    header += more;
+    result = scanner.scan(reinterpret_cast<const uchar*>(header.constData()), header.size(), ExifScanner::ScanImageSize);
+  }
+
+  IoStatistics::addBytes(IoStatistics::ThumbnailStage, header.size());
+
+  return scanner.getImageSize();
+}
+
+QImage ThumbnailLoader::loadEmbeddedPreview(const QString &filename, const QSize &size)
+{
+  ExifScanner scanner;
+  if (scanner.scanFile(filename, ExifScanner::ScanPreviews) != ExifScanner::Ok)
+    return QImage();
+
+  const QList<ExifScanner::Preview> previews = scanner.getPreviews();
+  const QSize imageSize = scanner.getImageSize();
+  if (previews.isEmpty() || imageSize.isEmpty())
+    return QImage();
+
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+    return QImage();
+
+  // only the headers are read here, the best preview is read in full afterwards:
+  const ExifScanner::Preview *best = 0;
+  qint64 bestPixels = 0;
+  for (QList<ExifScanner::Preview>::const_iterator it = previews.constBegin(); it!=previews.constEnd(); ++it)
+  {
+    qint64 pixels = 0;
+    if (isUsablePreview(readPreviewSize(file, it->offset, it->length), imageSize, size, &pixels) && (!best || (pixels < bestPixels)))
+    {
+      best = &*it;
+      bestPixels = pixels;
+    }
+  }
+
+  if (!best || !file.seek(best->offset))
+    return QImage();
+
+  const QByteArray bestData = file.read(best->length);
+  IoStatistics::addBytes(IoStatistics::ThumbnailStage, bestData.size());
+  if (bestData.size() != int(best->length))
+    return QImage();
+
+  QImage preview;
+  if (!preview.loadFromData(bestData, "JPEG"))
+    return QImage();
+
+  return ImageScaler::scaled(preview, size);
+}
+
+QImage ThumbnailLoader::loadEmbeddedPreview(const PhotoFile &file, const QSize &size)
+{
+  ExifScanner scanner;
+  if (scanner.scan(file.data(), file.size(), ExifScanner::ScanPreviews) != ExifScanner::Ok)
+    return QImage();
+
+  const QList<ExifScanner::Preview> previews = scanner.getPreviews();
+  const QSize imageSize = scanner.getImageSize();
+  if (previews.isEmpty() || imageSize.isEmpty())
+    return QImage();
+
+  // the previews are referenced in place, without copying them:
+  QByteArray bestData;
+  qint64 bestPixels = 0;
+  for (QList<ExifScanner::Preview>::const_iterator it = previews.constBegin(); it!=previews.constEnd(); ++it)
+  {
+    if ((it->offset < 0) || (it->offset + it->length > file.size()))
+      continue;
+
+    ExifScanner previewScanner;
+    previewScanner.scan(file.data() + it->offset, it->length, ExifScanner::ScanImageSize);
+    qint64 pixels = 0;
+    if (isUsablePreview(previewScanner.getImageSize(), imageSize, size, &pixels) && (bestData.isEmpty() || (pixels < bestPixels)))
+    {
+      bestData = QByteArray::fromRawData(reinterpret_cast<const char*>(file.data() + it->offset), it->length);
+      bestPixels = pixels;
+    }
+  }
+
+  if (bestData.isEmpty())
+    return QImage();
+
+  QImage preview;
+  if (!preview.loadFromData(bestData, "JPEG"))
+    return QImage();
+
+  return ImageScaler::scaled(preview, size);
+}
+
+QImage ThumbnailLoader::loadFullImage(const QString &filename, const QSize &size)
+{
+  // let libjpeg skip most of the pixels while decoding:
+  QImage image = JpegDecoder::decodeScaled(filename, size);
+  if (image.isNull())
+  {
+    image = QImage(filename);
+    IoStatistics::addBytes(IoStatistics::ThumbnailStage, QFileInfo(filename).size());
+  }
+
+  return ImageScaler::scaled(image, size);
+}
@@ -0,0 +1,50 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THUMBNAILLOADER_H
+#define THUMBNAILLOADER_H
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+class PhotoFile;
+class QFile;
+
+/**
+ * Creates thumbnails from the cheapest source available.
+ *
+ * The embedded previews of the file (MPF preview images and the EXIF
+ * thumbnail) are tried first, the smallest one which is big enough for the
+ * requested size wins. Only if none of them is big enough the full image
+ * is decoded, at a reduced size if libjpeg can do that.
+ */
+class ThumbnailLoader
+{
+  public:
+    static QImage load(const QString &filename, const QSize &size);
+    static QImage load(const PhotoFile &file, const QSize &size);
+
+  private:
+    static QImage loadEmbeddedPreview(const QString &filename, const QSize &size);
+    static QImage loadEmbeddedPreview(const PhotoFile &file, const QSize &size);
+    static bool isUsablePreview(const QSize &previewSize, const QSize &imageSize, const QSize &size, qint64 *pixels);
+    static QSize readPreviewSize(QFile &file, const qint64 offset, const quint32 length);
+    static QImage loadFullImage(const QString &filename, const QSize &size);
+};
+
+#endif
@@ -0,0 +1,279 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "thumbnailscheduler.h"
+#include "thumbnailscheduler.moc"
+#include "photofile.h"
+#include "thumbnailloader.h"
+#include "thumbnailstore.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThread>
+
+class ThumbnailSchedulerThread : public QThread
+{
+  public:
+    ThumbnailSchedulerThread(ThumbnailScheduler *scheduler)
+      : QThread(), m_scheduler(scheduler)
+    {
+    }
+
+  protected:
+    void run()
+    {
+      m_scheduler->run();
+    }
+
+  private:
+    ThumbnailScheduler *m_scheduler;
+
+  private:
+    Q_DISABLE_COPY(ThumbnailSchedulerThread)
+};
+
+ThumbnailScheduler::ThumbnailScheduler(ThumbnailStore *store, const int threadCount, QObject *parent)
+  : QObject(parent), m_store(store), m_queue(), m_requests(), m_groups(), m_running(), m_failed(), m_nextSequence(0),
+    m_minimumPriority(BackgroundPriority), m_paused(false), m_stopping(false), m_mutex(), m_requestAdded(), m_threads()
+{
+  // the threads only get the processor time which nobody else needs:
+  for (int i=0; i<qMax(threadCount, 1); ++i)
+  {
+    QThread *thread = new ThumbnailSchedulerThread(this);
+    m_threads.append(thread);
+    thread->start(QThread::IdlePriority);
+  }
+}
+
+ThumbnailScheduler::~ThumbnailScheduler()
+{
+  {
+    QMutexLocker locker(&m_mutex);
+    m_stopping = true;
+    m_requestAdded.wakeAll();
+  }
+
+  for (QList<QThread*>::const_iterator it = m_threads.constBegin(); it!=m_threads.constEnd(); ++it)
+  {
+    (*it)->wait();
+    delete *it;
+  }
+}
+
+/*
+ * Adds a request for the thumbnail of the given file, or moves an existing
+ * request ahead if the new priority is higher. Can be called from any thread.
+ */
+void ThumbnailScheduler::schedule(const QString &filename, const int priority)
+{
+  QMutexLocker locker(&m_mutex);
+  if (m_running.contains(filename) || m_failed.contains(filename))
+    return;
+
+  const QHash<QString, Request>::iterator it = m_requests.find(filename);
+  if (it != m_requests.end())
+  {
+    if (it->basePriority >= priority)
+      return;
+
+    it->basePriority = priority;
+    updatePriority(filename, &*it);
+  }
+  else
+  {
+    Request request;
+    request.basePriority = priority;
+    request.priority = effectivePriority(filename, priority);
+    request.sequence = m_nextSequence++;
+    m_queue.insert(Key(-request.priority, request.sequence), filename);
+    m_requests.insert(filename, request);
+  }
+
+  m_requestAdded.wakeOne();
+}
+
+/*
+ * Gives the given files at least the given priority, until the next call for
+ * the same priority replaces them. Files which are not scheduled are only
+ * remembered, they get the priority once they are scheduled.
+ */
+void ThumbnailScheduler::setPriority(const int priority, const QStringList &filenames)
+{
+  QMutexLocker locker(&m_mutex);
+
+  const QSet<QString> group = filenames.toSet();
+  QSet<QString> changed = m_groups.value(priority);
+  changed.unite(group);
+  if (group.isEmpty())
+  {
+    m_groups.remove(priority);
+  }
+  else
+  {
+    m_groups.insert(priority, group);
+  }
+
+  for (QSet<QString>::const_iterator it = changed.constBegin(); it!=changed.constEnd(); ++it)
+  {
+    const QHash<QString, Request>::iterator request = m_requests.find(*it);
+    if (request != m_requests.end())
+      updatePriority(*it, &*request);
+  }
+
+  m_requestAdded.wakeAll();
+}
+
+// the highest priority of the groups which contain the file, if it is above the one the file was scheduled with
+int ThumbnailScheduler::effectivePriority(const QString &filename, const int basePriority) const
+{
+  QMap<int, QSet<QString> >::const_iterator it = m_groups.constEnd();
+  while (it != m_groups.constBegin())
+  {
+    --it;
+    if (it.key() <= basePriority)
+      break;
+
+    if (it->contains(filename))
+      return it.key();
+  }
+
+  return basePriority;
+}
+
+void ThumbnailScheduler::updatePriority(const QString &filename, Request *request)
+{
+  const int priority = effectivePriority(filename, request->basePriority);
+  if (priority == request->priority)
+    return;
+
+  // the sequence is kept, so that a file which falls back gets its old place again:
+  m_queue.remove(Key(-request->priority, request->sequence));
+  request->priority = priority;
+  m_queue.insert(Key(-priority, request->sequence), filename);
+}
+
+// requests below the given priority are held back until the minimum is lowered again
+void ThumbnailScheduler::setMinimumPriority(const int priority)
+{
+  QMutexLocker locker(&m_mutex);
+  m_minimumPriority = priority;
+  m_requestAdded.wakeAll();
+}
+
+// thumbnails which are being created right now are still finished
+void ThumbnailScheduler::pause()
+{
+  QMutexLocker locker(&m_mutex);
+  m_paused = true;
+}
+
+void ThumbnailScheduler::resume()
+{
+  QMutexLocker locker(&m_mutex);
+  m_paused = false;
+  m_requestAdded.wakeAll();
+}
+
+// drops all requests which have not been started yet
+void ThumbnailScheduler::cancel()
+{
+  QMutexLocker locker(&m_mutex);
+  m_queue.clear();
+  m_requests.clear();
+}
+
+// files whose thumbnail failed may be scheduled again, they may have changed in the meantime
+void ThumbnailScheduler::clearFailed()
+{
+  QMutexLocker locker(&m_mutex);
+  m_failed.clear();
+}
+
+int ThumbnailScheduler::pendingCount()
+{
+  QMutexLocker locker(&m_mutex);
+  return m_queue.size() + m_running.size();
+}
+
+// waits for a request which may be worked on, returns false if the scheduler is destroyed
+bool ThumbnailScheduler::claimRequest(QString *filename)
+{
+  QMutexLocker locker(&m_mutex);
+  for (;;)
+  {
+    if (m_stopping)
+      return false;
+
+    if (!m_paused && !m_queue.isEmpty() && (-m_queue.constBegin().key().first >= m_minimumPriority))
+      break;
+
+    m_requestAdded.wait(&m_mutex);
+  }
+
+  const QMap<Key, QString>::iterator first = m_queue.begin();
+  *filename = first.value();
+  m_requests.remove(*filename);
+  m_queue.erase(first);
+  m_running.insert(*filename);
+  return true;
+}
+
+void ThumbnailScheduler::finishRequest(const QString &filename, const bool ok)
+{
+  QMutexLocker locker(&m_mutex);
+  m_running.remove(filename);
+  if (!ok)
+    m_failed.insert(filename);
+}
+
+void ThumbnailScheduler::run()
+{
+  QString filename;
+  while (claimRequest(&filename))
+  {
+    // thumbnails which were created before only have to be read from the on-disk cache:
+    if (m_store->load(filename))
+    {
+      finishRequest(filename, true);
+      emit(thumbnailCreated(filename));
+      continue;
+    }
+
+    PhotoFile file;
+    QImage thumbnail;
+    if (file.open(filename))
+    {
+      thumbnail = ThumbnailLoader::load(file, ThumbnailStore::levelSize(ThumbnailStore::LargeLevel));
+    }
+    else
+    {
+      thumbnail = ThumbnailLoader::load(filename, ThumbnailStore::levelSize(ThumbnailStore::LargeLevel));
+    }
+
+    m_store->insert(filename, thumbnail);
+    finishRequest(filename, !thumbnail.isNull());
+
+    if (thumbnail.isNull())
+    {
+      qDebug() << "ThumbnailScheduler: could not create a thumbnail for" << filename;
+    }
+    else
+    {
+      emit(thumbnailCreated(filename));
+    }
+  }
+}
@@ -0,0 +1,123 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THUMBNAILSCHEDULER_H
+#define THUMBNAILSCHEDULER_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+
+class QThread;
+class ThumbnailStore;
+
+/**
+ * Creates the thumbnails of imported photos in the background.
+ *
+ * An import only reads the metadata of the photos, so that they show up on
+ * the map right away, and hands the photos without a cached thumbnail to the
+ * scheduler. Its threads run at idle priority, create the thumbnails and put
+ * them into the ThumbnailStore, and thumbnailCreated() is emitted for every
+ * new thumbnail. The views schedule the thumbnails which the store does not
+ * have in memory, the threads then load them from the on-disk cache if they
+ * were created before, and thumbnailCreated() is emitted for those as well.
+ *
+ * Requests with a higher priority are worked on first, requests of the same
+ * priority in the order in which they were scheduled. Scheduling a file again
+ * with a higher priority moves it ahead. setPriority() raises a whole group of
+ * files, like the rows which are shown in the list, and replaces the group
+ * which had this priority before, so that files which scrolled out of view
+ * fall back to the priority they were scheduled with.
+ *
+ * Requests below the minimum priority wait until the minimum is lowered
+ * again, pause() holds all of them. Files for which no thumbnail could be
+ * created are not tried again until clearFailed() is called, which every
+ * import does.
+ */
+class ThumbnailScheduler : public QObject
+{
+  Q_OBJECT
+
+  public:
+    enum Priority
+    {
+      BackgroundPriority = 0,   // created some time after the import
+      ViewportPriority = 100,   // on the visible part of the map
+      VisiblePriority = 200,    // in the visible rows of the list
+      SelectedPriority = 300    // shown as the preview
+    };
+
+    ThumbnailScheduler(ThumbnailStore *store, const int threadCount, QObject *parent = 0);
+    ~ThumbnailScheduler();
+
+    void schedule(const QString &filename, const int priority = BackgroundPriority);
+    void setPriority(const int priority, const QStringList &filenames);
+    void setMinimumPriority(const int priority);
+    void pause();
+    void resume();
+    void cancel();
+    void clearFailed();
+    int pendingCount();
+
+  signals:
+    void thumbnailCreated(const QString &filename);
+
+  private:
+    // sorts the highest priority first and keeps the order of the requests within a priority:
+    typedef QPair<int, qint64> Key;
+
+    struct Request
+    {
+      int priority;
+      int basePriority;
+      qint64 sequence;
+    };
+
+    friend class ThumbnailSchedulerThread;
+
+    int effectivePriority(const QString &filename, const int basePriority) const;
+    void updatePriority(const QString &filename, Request *request);
+    bool claimRequest(QString *filename);
+    void finishRequest(const QString &filename, const bool ok);
+    void run();
+
+    ThumbnailStore *m_store;
+    QMap<Key, QString> m_queue;
+    QHash<QString, Request> m_requests;
+    QMap<int, QSet<QString> > m_groups;
+    QSet<QString> m_running;
+    QSet<QString> m_failed;
+    qint64 m_nextSequence;
+    int m_minimumPriority;
+    bool m_paused;
+    bool m_stopping;
+    QMutex m_mutex;
+    QWaitCondition m_requestAdded;
+    QList<QThread*> m_threads;
+
+  private:
+    Q_DISABLE_COPY(ThumbnailScheduler)
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "thumbnailstore.h"
+#include "imagescaler.h"
+#include "jpegdecoder.h"
+#include "thumbnailcache.h"
+#include "thumbnailloader.h"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+
+// the edge lengths of the levels, the large level is the size the thumbnails are created at:
+const int ThumbnailLevelSizes[ThumbnailStore::LevelCount] = { 64, 160, 280 };
+
+// the costs are counted in KB, so that budgets beyond 2 GB still fit into an int:
+static int budgetCost(const qint64 bytes)
+{
+  return qMax(int(bytes / 1024), 1);
+}
+
+ThumbnailStore::ThumbnailStore(ThumbnailCache *diskCache, const qint64 memoryBudget, const qint64 decodedMemoryBudget)
+  : m_diskCache(diskCache), m_missingFunction(0), m_missingData(0), m_encodedImages(budgetCost(memoryBudget)),
+    m_decodedImages(budgetCost(decodedMemoryBudget)), m_mutex()
+{
+}
+
+QSize ThumbnailStore::levelSize(const Level level)
+{
+  return QSize(ThumbnailLevelSizes[level], ThumbnailLevelSizes[level]);
+}
+
+// returns the smallest level which covers the given size
+ThumbnailStore::Level ThumbnailStore::levelFor(const QSize &size)
+{
+  const int edge = qMax(size.width(), size.height());
+  for (int level = SmallLevel; level < LargeLevel; ++level)
+  {
+    if (edge <= ThumbnailLevelSizes[level])
+      return Level(level);
+  }
+
+  return LargeLevel;
+}
+
+// lets thumbnail() hand missing thumbnails to someone else instead of creating them itself
+void ThumbnailStore::setMissingFunction(MissingFunction missingFunction, void *yourdata)
+{
+  m_missingFunction = missingFunction;
+  m_missingData = yourdata;
+}
+
+QImage ThumbnailStore::thumbnail(const QString &filename, const QSize &size)
+{
+  const Level level = levelFor(size);
+
+  QByteArray data;
+  {
+    QMutexLocker locker(&m_mutex);
+    const QImage * const image = m_decodedImages.object(DecodedKey(filename, level));
+    if (image)
+      return *image;
+
+    const QList<QByteArray> * const levels = m_encodedImages.object(filename);
+    if (levels && (levels->size() == LevelCount))
+      data = levels->at(level);
+  }
+
+  // the disk is not touched in here if someone else loads the thumbnail:
+  if (data.isEmpty() && m_missingFunction)
+  {
+    m_missingFunction(filename, size, m_missingData);
+    return QImage();
+  }
+
+  // loading may take a while, do not block the other threads meanwhile:
+  if (data.isEmpty() && load(filename))
+  {
+    QMutexLocker locker(&m_mutex);
+    const QList<QByteArray> * const levels = m_encodedImages.object(filename);
+    if (levels && (levels->size() == LevelCount))
+      data = levels->at(level);
+  }
+
+  if (data.isEmpty())
+  {
+    insert(filename, ThumbnailLoader::load(filename, levelSize(LargeLevel)));
+
+    QMutexLocker locker(&m_mutex);
+    const QList<QByteArray> * const levels = m_encodedImages.object(filename);
+    if (levels && (levels->size() == LevelCount))
+      data = levels->at(level);
+  }
+
+  if (data.isEmpty())
+    return QImage();
+
+  return decodeAndKeep(filename, level, data);
+}
+
+/*
+ * Loads the thumbnail from the on-disk cache into memory, returns false if
+ * the on-disk cache does not have it.
+ */
+bool ThumbnailStore::load(const QString &filename)
+{
+  if (!m_diskCache)
+    return false;
+
+  const QList<QByteArray> levels = m_diskCache->loadLevels(QFileInfo(filename));
+  if (levels.size() != LevelCount)
+    return false;
+
+  keepLevels(filename, levels);
+  return true;
+}
+
+/*
+ * Adds a new thumbnail, which should be of the size of the large level. The
+ * smaller levels are created from it and everything is also written to the
+ * on-disk cache. The levels are only decoded again when they are shown.
+ */
+void ThumbnailStore::insert(const QString &filename, const QImage &thumbnail)
+{
+  if (thumbnail.isNull())
+    return;
+
+  // every level is scaled down from the next larger one, which is cheaper and looks the same:
+  QList<QByteArray> levels;
+  QImage image = thumbnail;
+  for (int level = LargeLevel; level >= SmallLevel; --level)
+  {
+    if ((image.width() > ThumbnailLevelSizes[level]) || (image.height() > ThumbnailLevelSizes[level]))
+      image = ImageScaler::scaled(image, levelSize(Level(level)));
+
+    const QByteArray data = ThumbnailCache::encode(image);
+    if (data.isEmpty())
+      return;
+
+    levels.prepend(data);
+  }
+
+  if (m_diskCache)
+    m_diskCache->storeLevels(QFileInfo(filename), levels);
+
+  keepLevels(filename, levels);
+
+  // decoded images of an older version of the photo are outdated now:
+  QMutexLocker locker(&m_mutex);
+  for (int level = SmallLevel; level < LevelCount; ++level)
+  {
+    m_decodedImages.remove(DecodedKey(filename, level));
+  }
+}
+
+void ThumbnailStore::remove(const QString &filename)
+{
+  QMutexLocker locker(&m_mutex);
+  m_encodedImages.remove(filename);
+  for (int level = SmallLevel; level < LevelCount; ++level)
+  {
+    m_decodedImages.remove(DecodedKey(filename, level));
+  }
+}
+
+void ThumbnailStore::keepLevels(const QString &filename, const QList<QByteArray> &levels)
+{
+  qint64 size = 0;
+  for (QList<QByteArray>::const_iterator it = levels.constBegin(); it!=levels.constEnd(); ++it)
+  {
+    size += it->size();
+  }
+
+  QMutexLocker locker(&m_mutex);
+  m_encodedImages.insert(filename, new QList<QByteArray>(levels), budgetCost(size));
+}
+
+QImage ThumbnailStore::decodeAndKeep(const QString &filename, const Level level, const QByteArray &data)
+{
+  QImage image = JpegDecoder::decodeScaled(reinterpret_cast<const uchar*>(data.constData()), data.size(), levelSize(level));
+  if (image.isNull())
+    image.loadFromData(data, "JPEG");
+
+  if (!image.isNull())
+  {
+    QMutexLocker locker(&m_mutex);
+    m_decodedImages.insert(DecodedKey(filename, level), new QImage(image), budgetCost(image.byteCount()));
+  }
+
+  return image;
+}
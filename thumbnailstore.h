@@ -0,0 +1,95 @@
+/*
+    This file is part of Trippy.
+
+    Trippy is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Trippy is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Trippy.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THUMBNAILSTORE_H
+#define THUMBNAILSTORE_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QSize>
+#include <QString>
+
+class ThumbnailCache;
+
+/**
+ * Keeps the thumbnails of the photos in memory, up to a memory budget.
+ *
+ * Every photo has a small pyramid of thumbnails, which is created from one
+ * decode of the photo: the list icons use the small level, the preview the
+ * large one. Callers ask for the size they are going to paint and get the
+ * smallest level which covers it, so that no large image has to be scaled
+ * down in the GUI thread.
+ *
+ * The thumbnails are looked up by the file name of the photo and kept as
+ * JPEG data, in the same form as in the on-disk cache, which takes about a
+ * tenth of the memory of the decoded images. A second, much smaller cache
+ * holds the decoded images which were shown last, so that the visible rows
+ * of a view are not decoded again on every repaint. When a budget is used
+ * up, the least recently used entries are dropped. A thumbnail which is not
+ * in memory is loaded from the on-disk cache, or created from the photo
+ * itself if the on-disk cache does not have it. If a missing function is
+ * set, it is told about the missing thumbnail instead and thumbnail()
+ * returns a null image right away, so that views never wait for the disk.
+ * Whoever handles the missing thumbnails then calls load(), and insert() if
+ * the on-disk cache does not have the thumbnail either.
+ */
+class ThumbnailStore
+{
+  public:
+    typedef void (*MissingFunction)(const QString &filename, const QSize &size, void *yourdata);
+
+    enum Level
+    {
+      SmallLevel,
+      MediumLevel,
+      LargeLevel,
+      LevelCount
+    };
+
+    ThumbnailStore(ThumbnailCache *diskCache, const qint64 memoryBudget, const qint64 decodedMemoryBudget);
+
+    void setMissingFunction(MissingFunction missingFunction, void *yourdata);
+    QImage thumbnail(const QString &filename, const QSize &size);
+    bool load(const QString &filename);
+    void insert(const QString &filename, const QImage &thumbnail);
+    void remove(const QString &filename);
+
+    static QSize levelSize(const Level level);
+    static Level levelFor(const QSize &size);
+
+  private:
+    typedef QPair<QString, int> DecodedKey;
+
+    void keepLevels(const QString &filename, const QList<QByteArray> &levels);
+    QImage decodeAndKeep(const QString &filename, const Level level, const QByteArray &data);
+
+    ThumbnailCache *m_diskCache;
+    MissingFunction m_missingFunction;
+    void *m_missingData;
+    QCache<QString, QList<QByteArray> > m_encodedImages;
+    QCache<DecodedKey, QImage> m_decodedImages;
+    QMutex m_mutex;
+
+  private:
+    Q_DISABLE_COPY(ThumbnailStore)
+};
+
+#endif
@@ -19,47 +19,198 @@
 
 #include "trippy.h"
 #include "trippy.moc"
+#include "importreader.h"
+#include "loadscreen.h"
+#include "metadataindex.h"
+#include "photofile.h"
+#include "thumbnailcache.h"
+#include "thumbnailloader.h"
+#include "thumbnailscheduler.h"
+#include "thumbnailstore.h"
 
 Trippy::Trippy()
-: m_window(0), m_fileDialog(0), m_photos(), m_watcher()
+: m_window(0), m_fileDialog(0), m_photos(), m_watcher(), m_sortWatcher(0), m_thumbnailCache(0), m_thumbnailStore(0), m_thumbnailScheduler(0),
+  m_metadataIndex(0),
+  m_importQueue(), m_importTimer(0), m_importReader(0), m_loadImageHelper(0), m_loadScreen(),
+  m_importTime(), m_importInDiskOrder(false), m_sortingFiles(false)
 {
+  QSettings appSettings;
+  const QString cacheLocation = QDesktopServices::storageLocation(QDesktopServices::CacheLocation);
+  const qint64 thumbnailCacheSize = appSettings.value(QLatin1String("ThumbnailCacheSizeMB"), 256).toLongLong() * 1024 * 1024;
+  m_thumbnailCache = new ThumbnailCache(cacheLocation + QLatin1String("/thumbnails"), thumbnailCacheSize);
+  m_metadataIndex = new MetadataIndex(cacheLocation + QLatin1String("/metadata.index"));
+  const qint64 thumbnailMemory = appSettings.value(QLatin1String("ThumbnailMemoryMB"), 64).toLongLong() * 1024 * 1024;
+  const qint64 decodedThumbnailMemory = appSettings.value(QLatin1String("DecodedThumbnailMemoryMB"), 16).toLongLong() * 1024 * 1024;
+  m_thumbnailStore = new ThumbnailStore(m_thumbnailCache, thumbnailMemory, decodedThumbnailMemory);
+  m_photos.setThumbnailStore(m_thumbnailStore);
+
+  // thumbnails are created in the background, the views ask for the missing ones first:
+  const int thumbnailThreads = appSettings.value(QLatin1String("ThumbnailThreads"), QThread::idealThreadCount()).toInt();
+  m_thumbnailScheduler = new ThumbnailScheduler(m_thumbnailStore, thumbnailThreads);
+  m_thumbnailStore->setMissingFunction(&Trippy::thumbnailMissing, this);
+
   m_window = new Window();
   m_window->show();
   
   m_window->ui.lv_photos->setModel(&m_photos);
+  m_photos.setDecorationSize(m_window->ui.lv_photos->iconSize());
   m_window->m_marble->setPhotoModel(&m_photos);
   m_window->m_marble->setSelectionModel(m_window->ui.lv_photos->selectionModel());
+  connect(m_thumbnailScheduler, SIGNAL(thumbnailCreated(const QString&)), this, SLOT(thumbnailCreated(const QString&)));
+
+  // the thumbnails which are on screen are created first:
+  connect(m_window, SIGNAL(visiblePhotosChanged(const QStringList&)), this, SLOT(visiblePhotosChanged(const QStringList&)));
+  connect(m_window, SIGNAL(selectedPhotoChanged(const QString&)), this, SLOT(selectedPhotoChanged(const QString&)));
+  connect(m_window->m_marble, SIGNAL(viewportPhotosChanged(const QStringList&)),
+          this, SLOT(viewportPhotosChanged(const QStringList&)));
+  connect(&m_photos, SIGNAL(rowsInserted(const QModelIndex&, int, int)), m_window, SLOT(visibleRowsChanged()));
+  connect(&m_photos, SIGNAL(rowsRemoved(const QModelIndex&, int, int)), m_window, SLOT(visibleRowsChanged()));
+  connect(&m_photos, SIGNAL(layoutChanged()), m_window, SLOT(visibleRowsChanged()));
+  connect(&m_photos, SIGNAL(modelReset()), m_window, SLOT(visibleRowsChanged()));
 
   qRegisterMetaType<Photo>("Photo");
 
   m_watcher = new QFutureWatcher<QString>(this);
+  connect(m_watcher, SIGNAL(finished()), this, SLOT(importFinished()));
+  m_sortWatcher = new QFutureWatcher<QStringList>(this);
+  connect(m_sortWatcher, SIGNAL(finished()), this, SLOT(diskOrderReady()));
+
+  // the photos found by the import threads are moved into the model in batches:
+  m_importTimer = new QTimer(this);
+  m_importTimer->setInterval(100);
+  connect(m_importTimer, SIGNAL(timeout()), this, SLOT(drainImportQueue()));
 
   QObject::connect(m_window, SIGNAL(selectedFiles(const QStringList &)), this, SLOT(filesSelected(const QStringList &)));
-  connect(this, SIGNAL(photoReady(Photo)), this, SLOT(addPhoto(Photo)));
+}
+
+Trippy::~Trippy()
+{
+  // the sorting can not be canceled, the import is just not started:
+  m_sortWatcher->waitForFinished();
+  if (m_importReader)
+  {
+    m_watcher->cancel();
+    m_watcher->waitForFinished();
+    importFinished();
+  }
+  delete m_thumbnailScheduler;
+  delete m_thumbnailStore;
+  delete m_thumbnailCache;
+  delete m_metadataIndex;
 }
 
 struct LoadImageHelper
 {
-  LoadImageHelper(QStandardItemModel *model, LoadScreen *loadScreen, Trippy *trippy)
-      : m_model(model), m_loadScreen(loadScreen), m_trippy(trippy)
+  LoadImageHelper(PhotoModel *model, LoadScreen *loadScreen, Trippy *trippy, ThumbnailCache *thumbnailCache,
+                  ThumbnailStore *thumbnailStore, ThumbnailScheduler *thumbnailScheduler, MetadataIndex *metadataIndex,
+                  ImportReader *importReader)
+      : m_model(model), m_loadScreen(loadScreen), m_trippy(trippy), m_thumbnailCache(thumbnailCache),
+        m_thumbnailStore(thumbnailStore), m_thumbnailScheduler(thumbnailScheduler), m_metadataIndex(metadataIndex),
+        m_importReader(importReader)
+  {
+  }
+
+  // tells the ImportReader which files operator() will not need to read
+  static bool canSkipRead(const QString &filename, void *yourdata)
+  {
+    const LoadImageHelper * const helper = static_cast<LoadImageHelper*>(yourdata);
+    MetadataIndex::Entry entry;
+    return helper->m_metadataIndex->lookup(QFileInfo(filename), &entry);
+  }
+
+  /*
+   * Tells whether Exiv2 failed because of the contents of the file. The
+   * codes are those of Exiv2's error table: failed system calls, files which
+   * could not be opened and reads which came up short are not, they may be
+   * gone on the next try, for example once the file has been copied completely.
+   */
+  static bool isParseError(const Exiv2::AnyError &error)
   {
+    switch (int(error.code()))
+    {
+      case 2:   // a system call failed
+      case 9:   // the data source could not be opened
+      case 10:  // the file could not be opened
+      case 14:  // the image data could not be read
+      case 20:  // the input data could not be read
+        return false;
+      default:
+        return true;
+    }
+  }
+
+  // the file was not written to while it was parsed
+  static bool isUnchanged(const QFileInfo &info)
+  {
+    const QFileInfo current(info.filePath());
+    return current.exists() && (current.size() == info.size()) && (current.lastModified() == info.lastModified());
   }
 
   typedef QString result_type;
-  QStandardItemModel *m_model;
+  PhotoModel *m_model;
   LoadScreen *m_loadScreen;
   Trippy *m_trippy;
+  ThumbnailCache *m_thumbnailCache;
+  ThumbnailStore *m_thumbnailStore;
+  ThumbnailScheduler *m_thumbnailScheduler;
+  MetadataIndex *m_metadataIndex;
+  ImportReader *m_importReader;
 
   QString operator()(const QString &filename)
   {
     qDebug()<<"LoadImageHelper::operator()("<<filename<<")";
+    const QFileInfo info(filename);
     try
     {
       m_trippy->fileLoadingFromConcurrent(filename);
-      Photo photo(filename);
+
+      // the readers only read the EXIF data of files which the index does not know:
+      PhotoFile header;
+      QByteArray prefetched;
+      if (m_importReader->take(filename, &prefetched))
+      {
+        header.setContents(filename, prefetched);
+      }
+
+      // only parse the file if the index does not know it in its current state:
+      Photo photo;
+      MetadataIndex::Entry entry;
+      if (m_metadataIndex->lookup(info, &entry))
+      {
+        if (entry.status == MetadataIndex::GeoTagged)
+        {
+          photo = Photo(filename, entry.timestamp, entry.gpsLat, entry.gpsLong);
+        }
+      }
+      else
+      {
+        if (header.isOpen())
+        {
+          photo = Photo(header);
+        }
+        else
+        {
+          photo = Photo(filename);
+        }
+
+        if (photo.isGeoTagged())
+        {
+          m_metadataIndex->store(info, MetadataIndex::GeoTagged, photo.getGpsLat(), photo.getGpsLong(), photo.getTimestamp());
+        }
+        else
+        {
+          m_metadataIndex->store(info, MetadataIndex::NotGeoTagged);
+        }
+      }
+
       if (photo.isGeoTagged())
       {
-        photo.getThumbnailImage(); // cause the thumbnail to be generated
+        // the thumbnail is created later on, the photo can already be shown on the map:
+        photo.setThumbnailStore(m_thumbnailStore);
+        if (!m_thumbnailCache->contains(info))
+        {
+          m_thumbnailScheduler->schedule(filename);
+        }
         m_trippy->photoReadyFromConcurrent(photo);
       }
       else
@@ -67,6 +218,16 @@ struct LoadImageHelper
         m_trippy->fileFailedFromConcurrent(filename);
       }
     }
+    catch (Exiv2::AnyError& e)
+    {
+      qDebug()<<"Exception: "<<e.what();
+      // only files which can not be parsed are remembered, read errors are tried again on the next import:
+      if (isParseError(e) && isUnchanged(info))
+      {
+        m_metadataIndex->store(info, MetadataIndex::Failed);
+      }
+      m_trippy->fileFailedFromConcurrent(filename);
+    }
     catch (std::exception& e)
     {
       qDebug()<<"Exception: "<<e.what();
@@ -78,11 +239,11 @@ struct LoadImageHelper
 
 };
 
-// this is a forwarding-function which is called from the thread created by QtConcurrent and transports the data into the GUI-thread
-void Trippy::photoReadyFromConcurrent(Photo photo)
+// this is called from the threads created by QtConcurrent, the GUI-thread picks the photos up in drainImportQueue()
+void Trippy::photoReadyFromConcurrent(const Photo &photo)
 {
-  qDebug()<<"void Trippy::photoReadyFromConcurrent(Photo photo): "<<photo.getFilename();
-  emit(photoReady(photo));
+  qDebug()<<"void Trippy::photoReadyFromConcurrent(const Photo &photo): "<<photo.getFilename();
+  m_importQueue.push(photo);
 }
 
 // this is a forwarding-function which is called from the thread created by QtConcurrent and transports the data into the GUI-thread
@@ -96,88 +257,166 @@ void Trippy::filesSelected(const QStringList &selected)
 {
   if (selected.isEmpty())
     return;
+
+  // only one import runs at a time:
+  if (m_importReader || m_sortingFiles)
+  {
+    if (m_loadScreen)
+    {
+      m_loadScreen->show();
+      m_loadScreen->raise();
+    }
+    return;
+  }
   
   QStringList sortedFiles = selected;
   sortedFiles.sort();
 
-  LoadScreen *loadScreen = new LoadScreen(m_window, m_watcher);
-  connect(this, SIGNAL(fileLoading(QString)), loadScreen, SLOT(setProgressText(QString)));
-  connect(this, SIGNAL(fileFailed(QString)), loadScreen, SLOT(addFailedFile(QString)));
+  // the previous load screen may still be open:
+  if (m_loadScreen)
+  {
+    m_loadScreen->close();
+  }
 
-  loadScreen->show();
+  // the load screen only shows the progress, the list and the map can be used while the import runs:
+  m_loadScreen = new LoadScreen(m_window, m_watcher);
+  m_loadScreen->setAttribute(Qt::WA_DeleteOnClose);
+  m_loadScreen->setModal(false);
+  connect(this, SIGNAL(fileLoading(QString)), m_loadScreen, SLOT(setProgressText(QString)));
+  connect(this, SIGNAL(fileFailed(QString)), m_loadScreen, SLOT(addFailedFile(QString)));
+
+  m_loadScreen->show();
+  IoStatistics::reset();
+  m_importTime.start();
+
+  // on hard disks, seeking between the files costs more than reading them. Finding their
+  // location needs a seek per file as well, so it is done in the background:
+  m_importInDiskOrder = m_window->ui.actionImportInDiskOrder->isChecked();
+  if (m_importInDiskOrder)
+  {
+    m_sortingFiles = true;
+    m_loadScreen->showCancel(false);
+    m_loadScreen->setProgressText(tr("Sorting the files by their location on the disk"));
+    m_sortWatcher->setFuture(QtConcurrent::run(&ImportReader::sortByDiskLocation, sortedFiles));
+    return;
+  }
+
+  startImport(sortedFiles);
+}
+
+// called once the files of an import are sorted by their location on the disk
+void Trippy::diskOrderReady()
+{
+  m_sortingFiles = false;
+  if (m_loadScreen)
+  {
+    m_loadScreen->showCancel(true);
+  }
+  startImport(m_sortWatcher->result());
+}
+
+void Trippy::startImport(const QStringList &files)
+{
+  // the files are read ahead by their own threads, so that the decoding threads do not wait for the disk:
+  QSettings appSettings;
+  const int queueDepth = appSettings.value(QLatin1String("ImportQueueDepth"), 8).toInt();
+  const qint64 bufferBudget = appSettings.value(QLatin1String("ImportBufferSizeMB"), 64).toLongLong() * 1024 * 1024;
+  m_importReader = new ImportReader(files, queueDepth, bufferBudget);
+  m_loadImageHelper = new LoadImageHelper(&m_photos, m_loadScreen, this, m_thumbnailCache, m_thumbnailStore,
+                                          m_thumbnailScheduler, m_metadataIndex, m_importReader);
+  m_importReader->setSkipFunction(&LoadImageHelper::canSkipRead, m_loadImageHelper);
+  if (m_importInDiskOrder)
+  {
+    m_importReader->setReadAhead(2 * queueDepth);
+  }
+  m_importReader->start();
+
+  // the files may have changed since their thumbnails failed:
+  m_thumbnailScheduler->clearFailed();
 
-  // do the expensive loading of the EXIF-data and scaling to the thumbnail in separate threads:
-  QFuture<QString> resultingNames = QtConcurrent::mapped(sortedFiles, LoadImageHelper(&m_photos, loadScreen, this));
-  m_watcher->setFuture(resultingNames);
+  // only the thumbnails which are shown are created before all photos are on the map:
+  m_thumbnailScheduler->setMinimumPriority(ThumbnailScheduler::VisiblePriority);
 
-  loadScreen->exec();
+  // do the expensive loading of the EXIF-data in separate threads:
+  m_watcher->setFuture(QtConcurrent::mapped(files, *m_loadImageHelper));
+  m_importTimer->start();
+}
+
+// called by the watcher once all threads are done, also if the import was canceled
+void Trippy::importFinished()
+{
+  if (!m_importReader)
+    return;
+
+  m_importTimer->stop();
+  m_importReader->stop();
+
+  // the thumbnails of the remaining photos are created when they are shown:
+  if (m_watcher->isCanceled())
+  {
+    m_thumbnailScheduler->cancel();
+  }
+  m_thumbnailScheduler->setMinimumPriority(ThumbnailScheduler::BackgroundPriority);
 
-  resultingNames.waitForFinished();
+  // nothing is pushed anymore, so this takes the rest:
+  drainImportQueue();
 
-  loadScreen->deleteLater();
+  const qreal importSeconds = qMax(m_importTime.elapsed(), 1) / 1000.0;
+  const qreal importMegabytes = IoStatistics::totalBytes() / (1024.0 * 1024.0);
+  qDebug() << "Import finished," << IoStatistics::summary();
+  qDebug() << "Read" << importMegabytes << "MB in" << importSeconds << "s:" << importMegabytes / importSeconds << "MB/s"
+           << (m_importInDiskOrder ? "in disk order" : "in name order");
 
-  sortPhotos();
+  delete m_importReader;
+  m_importReader = 0;
+  delete m_loadImageHelper;
+  m_loadImageHelper = 0;
+}
+
+/* Moves the photos found so far into the model. All photos which arrived
+   since the last tick of the timer are sorted and merged at once, which
+   costs one pass over the model, so the list and the map stay responsive
+   during large imports. */
+void Trippy::drainImportQueue()
+{
+  const QList<Photo> photos = m_importQueue.takeAll();
+  if (photos.isEmpty())
+    return;
+
+  m_photos.addPhotos(photos);
   m_window->repaintMarbleWidget();
+}
 
+// called by the thumbnail store when a view asks for a thumbnail which has not been created yet
+void Trippy::thumbnailMissing(const QString &filename, const QSize &size, void *yourdata)
+{
+  Q_UNUSED(size)
+
+  // the priority comes from the visible rows, the preview and the map:
+  Trippy * const trippy = static_cast<Trippy*>(yourdata);
+  trippy->m_thumbnailScheduler->schedule(filename);
 }
 
-//Takes a Photo object and creates a QStandardItem, then places it into the model.
-void Trippy::addPhoto(Photo photo)
+// the list and the preview show thumbnails which were created or loaded in the background
+void Trippy::thumbnailCreated(const QString &filename)
 {
-  QStandardItem *newItem = new QStandardItem(photo.getIcon(), photo.getTimestamp().toString());
-  newItem->setEditable(false);
-  newItem->setData(QVariant::fromValue(photo), PhotoRole);
-  newItem->setData(photo.getTimestamp(), TimestampRole);
-  newItem->setData(false, SelectedRole);
-  newItem->setData(photo.getFilename(), Qt::ToolTipRole);
-  m_photos.appendRow(newItem);
+  m_photos.thumbnailCreated(filename);
+  m_window->thumbnailCreated(filename);
 }
 
-void Trippy::sortPhotos()
+void Trippy::visiblePhotosChanged(const QStringList &filenames)
 {
-  QList<QStandardItem *> photos;
-  
-  //Move the items from the model to a list...
-  while (m_photos.rowCount() > 0)
-  {
-    photos.append(m_photos.takeRow(0).first());
-  }
+  m_thumbnailScheduler->setPriority(ThumbnailScheduler::VisiblePriority, filenames);
+}
 
-  /* A very simple version of insertion sort from wikipedia...
-
-  insertionSort(array A)
-    for i = 1 to length[A]-1 do
-    begin
-        value = A[i]
-        j = i-1
-        while j ≥ 0 and A[j] > value do
-        begin
-            A[j + 1] = A[j]
-            j = j-1
-        end
-        A[j+1] = value
-    end
-  */
-
-  //Using insertion sort to sort the items in the List by timestamp.
-  for (int n=0; n < photos.size(); ++n)
-  {
-    QStandardItem *temp = photos.at(n);
-    int j = n - 1;
-    while ((j >= 0) && 
-          (photos.at(j)->data(TimestampRole).toDateTime() > temp->data(TimestampRole).toDateTime()))
-    {
-      photos[j + 1] = photos.at(j);
-      j = j-1;
-    }
-    photos[j+1] = temp;
-  }
+void Trippy::viewportPhotosChanged(const QStringList &filenames)
+{
+  m_thumbnailScheduler->setPriority(ThumbnailScheduler::ViewportPriority, filenames);
+}
 
-  //Put the sorted items back into the model.
-  for (int k=0; k < photos.size(); ++k)
-  {
-    m_photos.insertRow(k, photos.at(k));
-  }
+void Trippy::selectedPhotoChanged(const QString &filename)
+{
+  m_thumbnailScheduler->setPriority(ThumbnailScheduler::SelectedPriority, QStringList(filename));
 }
 
 void Trippy::fileLoadingFromConcurrent(QString filename)
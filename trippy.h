@@ -21,36 +21,68 @@
 #define TRIPPY_H
 
 #include <QtGui>
-#include <QStandardItem>
 
 #include "window.h"
 #include "photo.h"
 #include "roles.h"
+#include "photomodel.h"
+#include "importqueue.h"
+
+class ImportReader;
+struct LoadImageHelper;
+class LoadScreen;
+class MetadataIndex;
+class ThumbnailCache;
+class ThumbnailScheduler;
+class ThumbnailStore;
 
 class Trippy : public QObject
 {
   Q_OBJECT
   public:
     Trippy();
+    ~Trippy();
 
   private:
     Window *m_window;
     QFileDialog *m_fileDialog;
-    QStandardItemModel m_photos;
+    PhotoModel m_photos;
     QFutureWatcher<QString> *m_watcher;
+    QFutureWatcher<QStringList> *m_sortWatcher;
+    ThumbnailCache *m_thumbnailCache;
+    ThumbnailStore *m_thumbnailStore;
+    ThumbnailScheduler *m_thumbnailScheduler;
+    MetadataIndex *m_metadataIndex;
+
+    // state of the running import:
+    ImportQueue m_importQueue;
+    QTimer *m_importTimer;
+    ImportReader *m_importReader;
+    LoadImageHelper *m_loadImageHelper;
+    QPointer<LoadScreen> m_loadScreen;
+    QTime m_importTime;
+    bool m_importInDiskOrder;
+    bool m_sortingFiles;
+
+    void startImport(const QStringList &files);
+    static void thumbnailMissing(const QString &filename, const QSize &size, void *yourdata);
 
   private slots:
-    void addPhoto(Photo photo);
-    void sortPhotos();
+    void diskOrderReady();
+    void thumbnailCreated(const QString &filename);
+    void drainImportQueue();
+    void importFinished();
+    void visiblePhotosChanged(const QStringList &filenames);
+    void viewportPhotosChanged(const QStringList &filenames);
+    void selectedPhotoChanged(const QString &filename);
 
   public slots:
     void filesSelected(const QStringList &files);
-    void photoReadyFromConcurrent(Photo photo);
+    void photoReadyFromConcurrent(const Photo &photo);
     void fileFailedFromConcurrent(QString filename);
     void fileLoadingFromConcurrent(QString filename);
 
   signals:
-    void photoReady(Photo photo);
     void fileLoading(QString filename);
     void fileFailed(QString filename);
     
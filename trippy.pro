@@ -10,9 +10,13 @@ INCLUDEPATH += .
 INCLUDEPATH += /usr/include/marble/
 
 # Input
-HEADERS += window.h photo.h trippy.h trippymarblewidget.h loadscreen.h roles.h markerclusterholder.h
+HEADERS += window.h photo.h trippy.h trippymarblewidget.h loadscreen.h roles.h markerclusterholder.h exifscanner.h thumbnailloader.h jpegdecoder.h thumbnailcache.h metadataindex.h photofile.h importreader.h thumbnailstore.h photomodel.h imagescaler.h importqueue.h thumbnailscheduler.h markerprojection.h
 FORMS += window.ui loadscreen.ui
-SOURCES += main.cpp window.cpp photo.cpp trippy.cpp trippymarblewidget.cpp loadscreen.cpp markerclusterholder.cpp
+SOURCES += main.cpp window.cpp photo.cpp trippy.cpp trippymarblewidget.cpp loadscreen.cpp markerclusterholder.cpp exifscanner.cpp thumbnailloader.cpp jpegdecoder.cpp thumbnailcache.cpp metadataindex.cpp photofile.cpp importreader.cpp thumbnailstore.cpp photomodel.cpp imagescaler.cpp importqueue.cpp thumbnailscheduler.cpp markerprojection.cpp
 
 LIBS += -L/usr/lib -lmarblewidget
 LIBS += -lexiv2
+LIBS += -ljpeg
+# optional, for asynchronous reads during the import:
+# DEFINES += TRIPPY_HAVE_LIBURING
+# LIBS += -luring
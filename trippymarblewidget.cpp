@@ -24,9 +24,17 @@
 #include <GeoDataPoint.h>
 #include "markerclusterholder.h"
 
+// thumbnails for more photos could not be created before the map is moved again
+const int MaximumViewportPhotos = 200;
+
 TrippyMarbleWidget::TrippyMarbleWidget(QWidget *parent)
-  : MarbleWidget(parent), m_photoModel(0), m_selectionModel(0), m_markerClusterHolder(new MarkerClusterHolder(this)), m_useClustering(true)
+  : MarbleWidget(parent), m_photoModel(0), m_selectionModel(0), m_markerClusterHolder(new MarkerClusterHolder(this)), m_useClustering(true),
+    m_viewportTimer(new QTimer(this)), m_compactedRows(), m_lastZoom(-1), m_lastCenterLatitude(0), m_lastCenterLongitude(0)
 {
+  // tell which photos are on the map once panning and zooming has come to rest:
+  m_viewportTimer->setSingleShot(true);
+  m_viewportTimer->setInterval(200);
+  connect(m_viewportTimer, SIGNAL(timeout()), this, SLOT(slotUpdateViewportPhotos()));
 }
 
 void TrippyMarbleWidget::slotSetUseClustering(const bool doIt)
@@ -35,25 +43,27 @@ void TrippyMarbleWidget::slotSetUseClustering(const bool doIt)
   update();
 }
 
-void TrippyMarbleWidget::setPhotoModel(QStandardItemModel *model)
+void TrippyMarbleWidget::setPhotoModel(PhotoModel *model)
 {
   m_photoModel = model;
   connect(m_photoModel, SIGNAL(rowsInserted(const QModelIndex&, int, int)),
           this, SLOT(slotModelRowsAdded(const QModelIndex&, int, int)));
   connect(m_photoModel, SIGNAL(rowsAboutToBeRemoved(const QModelIndex&, int, int)),
           this, SLOT(slotModelRowsAboutToBeRemoved(const QModelIndex&, int, int)));
+  connect(m_photoModel, SIGNAL(rowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)),
+          this, SLOT(slotModelRowsMoved(const QModelIndex&, int, int, const QModelIndex&, int)));
+  connect(m_photoModel, SIGNAL(layoutChanged()),
+          this, SLOT(slotModelLayoutChanged()));
+  connect(m_photoModel, SIGNAL(rowsAboutToBeCompacted(const QList<int>&)),
+          this, SLOT(slotModelRowsAboutToBeCompacted(const QList<int>&)));
   connect(m_photoModel, SIGNAL(modelReset()),
-          m_markerClusterHolder, SLOT(clear()));
-}
-
-template<> MarkerClusterHolder::MarkerInfo MarkerClusterHolder::MarkerInfo::fromData<Photo>(const Photo& yourdata)
-{
-  return MarkerClusterHolder::MarkerInfo(yourdata.getGpsLong(), yourdata.getGpsLat(), QVariant::fromValue(yourdata));
+          this, SLOT(slotModelReset()));
 }
 
-template<> Photo MarkerClusterHolder::MarkerInfo::data<Photo>() const
+// the markers only carry the id of their photo, the model has everything else
+static MarkerClusterHolder::MarkerInfo markerForRow(const PhotoModel *model, const int row)
 {
-  return m_data.value<Photo>();
+  return MarkerClusterHolder::MarkerInfo(model->longitude(row), model->latitude(row), model->photoId(row));
 }
 
 void TrippyMarbleWidget::slotModelRowsAdded(const QModelIndex& parent, int start, int end)
@@ -65,11 +75,10 @@ void TrippyMarbleWidget::slotModelRowsAdded(const QModelIndex& parent, int start
   MarkerClusterHolder::MarkerInfo::List markerList;
   for (int i=start; i<=end; ++i)
   {
-    const QVariant v = m_photoModel->item(i)->data(PhotoRole);
-    const Photo current = v.value<Photo>();
-    markerList << MarkerClusterHolder::MarkerInfo::fromData<Photo>(current);
+    markerList << markerForRow(m_photoModel, i);
   }
-  m_markerClusterHolder->addMarkers(markerList);
+  m_markerClusterHolder->insertMarkers(start, markerList);
+  m_viewportTimer->start();
 }
 
 void TrippyMarbleWidget::slotModelRowsAboutToBeRemoved(const QModelIndex& parent, int start, int end)
@@ -78,6 +87,88 @@ void TrippyMarbleWidget::slotModelRowsAboutToBeRemoved(const QModelIndex& parent
   
   qDebug()<<QString("slotModelRowsAboutToBeRemoved: start=%1, end=%2").arg(start).arg(end);
   m_markerClusterHolder->removeMarkers(start, end);
+  m_viewportTimer->start();
+}
+
+void TrippyMarbleWidget::slotModelRowsMoved(const QModelIndex& sourceParent, int start, int end,
+                                            const QModelIndex& destinationParent, int destinationRow)
+{
+  Q_UNUSED(sourceParent)
+  Q_UNUSED(destinationParent)
+
+  m_markerClusterHolder->moveMarkers(start, end, destinationRow);
+}
+
+/* The model is about to remove rows which are spread over it with a reset,
+   the markers of these rows are removed in one pass once it is done. */
+void TrippyMarbleWidget::slotModelRowsAboutToBeCompacted(const QList<int>& rows)
+{
+  m_compactedRows = rows;
+}
+
+void TrippyMarbleWidget::slotModelReset()
+{
+  if (m_compactedRows.isEmpty())
+  {
+    slotModelLayoutChanged();
+    return;
+  }
+
+  m_markerClusterHolder->removeMarkers(m_compactedRows);
+  m_compactedRows.clear();
+  m_viewportTimer->start();
+}
+
+/* The rows were sorted again or replaced. The markers are kept in the order
+   of the rows, so they are created again from the model in one pass, and
+   the selection and solo states are carried over by the photo ids. */
+void TrippyMarbleWidget::slotModelLayoutChanged()
+{
+  typedef QPair<bool, bool> MarkerState;
+  QHash<int, MarkerState> states;
+  const MarkerClusterHolder::MarkerInfo::List& oldMarkers = m_markerClusterHolder->markers();
+  for (MarkerClusterHolder::MarkerInfo::List::const_iterator it = oldMarkers.constBegin(); it!=oldMarkers.constEnd(); ++it)
+  {
+    if (it->isSelected() || it->isSolo())
+    {
+      states.insert(it->data<int>(), MarkerState(it->isSelected(), it->isSolo()));
+    }
+  }
+
+  MarkerClusterHolder::MarkerInfo::List markerList;
+  for (int i=0; i<m_photoModel->rowCount(); ++i)
+  {
+    MarkerClusterHolder::MarkerInfo marker = markerForRow(m_photoModel, i);
+    const QHash<int, MarkerState>::const_iterator state = states.constFind(marker.data<int>());
+    if (state != states.constEnd())
+    {
+      marker.setSelected(state->first);
+      marker.setSolo(state->second);
+    }
+    markerList << marker;
+  }
+  m_markerClusterHolder->setMarkers(markerList);
+  m_viewportTimer->start();
+}
+
+/* Collects the file names of the photos which are on the visible part of the
+   map. The clusters know which markers are on the map, nothing is projected
+   here. Only as many photos as can be prefetched before the map is likely to
+   be moved again are returned, spread over all clusters. */
+void TrippyMarbleWidget::slotUpdateViewportPhotos()
+{
+  if (!m_photoModel)
+    return;
+
+  const MarkerClusterHolder::QIntList markerIndices = m_markerClusterHolder->visibleMarkers(MaximumViewportPhotos);
+  QStringList filenames;
+  for (MarkerClusterHolder::QIntList::const_iterator it = markerIndices.constBegin(); it!=markerIndices.constEnd(); ++it)
+  {
+    // the markers are in the order of the rows:
+    filenames << m_photoModel->filename(*it);
+  }
+
+  emit(viewportPhotosChanged(filenames));
 }
 
 void TrippyMarbleWidget::setSelectionModel(QItemSelectionModel *model)
@@ -89,6 +180,15 @@ void TrippyMarbleWidget::customPaint(GeoPainter *painter)
 {
   if (!m_photoModel)
     return; // no photos to display!
+
+  // the photos on the map change when the map is panned or zoomed:
+  if ((zoom() != m_lastZoom) || (centerLatitude() != m_lastCenterLatitude) || (centerLongitude() != m_lastCenterLongitude))
+  {
+    m_lastZoom = zoom();
+    m_lastCenterLatitude = centerLatitude();
+    m_lastCenterLongitude = centerLongitude();
+    m_viewportTimer->start();
+  }
     
   if (m_useClustering)
   {
@@ -103,10 +203,7 @@ void TrippyMarbleWidget::customPaint(GeoPainter *painter)
   GeoDataPoint lastPoint;
   for (int i=0; i<m_photoModel->rowCount(); ++i)
   {
-    const QVariant v = m_photoModel->item(i)->data(PhotoRole);
-    const Photo current = v.value<Photo>();
-
-    const GeoDataPoint currentPoint = GeoDataPoint(current.getGpsLong(), current.getGpsLat(), 0 , GeoDataCoordinates::Degree);
+    const GeoDataPoint currentPoint = GeoDataPoint(m_photoModel->longitude(i), m_photoModel->latitude(i), 0 , GeoDataCoordinates::Degree);
     painter->drawEllipse(currentPoint, 6, 6);
 
     if (i > 0)
@@ -127,16 +224,13 @@ void TrippyMarbleWidget::customPaint(GeoPainter *painter)
   QModelIndexList selectedIndices = m_selectionModel->selectedIndexes();
   for (QModelIndexList::const_iterator it = selectedIndices.begin(); it!=selectedIndices.end(); ++it)
   {
-    const QVariant v = m_photoModel->itemFromIndex(*it)->data(PhotoRole);
-    const Photo current = v.value<Photo>();
-    const GeoDataPoint currentPoint = GeoDataPoint(current.getGpsLong(), current.getGpsLat(), 0 , GeoDataCoordinates::Degree);
+    const GeoDataPoint currentPoint = GeoDataPoint(m_photoModel->longitude(it->row()), m_photoModel->latitude(it->row()), 0 , GeoDataCoordinates::Degree);
     painter->drawEllipse(currentPoint, 6, 6);
 
     if (it->row()>0)
     {
-      const QVariant v = m_photoModel->item(it->row()-1)->data(PhotoRole);
-      const Photo previous = v.value<Photo>();
-      const GeoDataPoint previousPoint = GeoDataPoint(previous.getGpsLong(), previous.getGpsLat(), 0 , GeoDataCoordinates::Degree);
+      const int previous = it->row()-1;
+      const GeoDataPoint previousPoint = GeoDataPoint(m_photoModel->longitude(previous), m_photoModel->latitude(previous), 0 , GeoDataCoordinates::Degree);
       painter->drawLine(currentPoint, previousPoint);
     }
   }
@@ -22,11 +22,12 @@
 
 #include <MarbleWidget.h>
 #include <GeoPainter.h>
-#include <QStandardItemModel>
 
 #include "photo.h"
+#include "photomodel.h"
 #include "roles.h"
 #include <QItemSelectionModel>
+#include <QTimer>
 
 using namespace Marble;
 
@@ -38,11 +39,14 @@ class TrippyMarbleWidget : public MarbleWidget
   
   public:
     TrippyMarbleWidget(QWidget *parent=0);
-    void setPhotoModel(QStandardItemModel *model);
+    void setPhotoModel(PhotoModel *model);
     void setSelectionModel(QItemSelectionModel *model);
 
   public slots:
     void slotSetUseClustering(const bool doIt);
+
+  signals:
+    void viewportPhotosChanged(const QStringList &filenames);
     
   protected:
     void customPaint(GeoPainter *painter);
@@ -50,12 +54,23 @@ class TrippyMarbleWidget : public MarbleWidget
   private slots:
     void slotModelRowsAdded(const QModelIndex& parent, int start, int end);
     void slotModelRowsAboutToBeRemoved(const QModelIndex& parent, int start, int end);
+    void slotModelRowsMoved(const QModelIndex& sourceParent, int start, int end, const QModelIndex& destinationParent, int destinationRow);
+    void slotModelLayoutChanged();
+    void slotModelRowsAboutToBeCompacted(const QList<int>& rows);
+    void slotModelReset();
+    void slotUpdateViewportPhotos();
     
   private:
-    QStandardItemModel *m_photoModel;
+    PhotoModel *m_photoModel;
     QItemSelectionModel *m_selectionModel;
     MarkerClusterHolder *m_markerClusterHolder;
     bool m_useClustering;
+    QTimer *m_viewportTimer;
+    // rows which the model removes with the next reset:
+    QList<int> m_compactedRows;
+    int m_lastZoom;
+    qreal m_lastCenterLatitude;
+    qreal m_lastCenterLongitude;
     
   private:
     Q_DISABLE_COPY(TrippyMarbleWidget)
@@ -19,9 +19,12 @@
 
 #include "window.h"
 #include "window.moc"
+#include "photomodel.h"
+#include "thumbnailstore.h"
 
 Window::Window(QWidget *parent)
-    :QMainWindow(parent), ui(), m_marble(0), m_fileDialog(0), m_actionGroupMap(0), m_actionGroupProjection(0)
+    :QMainWindow(parent), ui(), m_marble(0), m_fileDialog(0), m_actionGroupMap(0), m_actionGroupProjection(0),
+     m_previewPhoto(), m_visibleRowsTimer(0)
 {
   ui.setupUi(this);
 
@@ -55,6 +58,7 @@ Window::Window(QWidget *parent)
   QSettings appSettings;
   ui.actionZoomOnSelectedPhoto->setChecked(appSettings.value(QLatin1String("ZoomOnSelectedPhoto"), true).toBool());
   ui.actionUseClustering->setChecked(appSettings.value(QLatin1String("UseClustering"), true).toBool());
+  ui.actionImportInDiskOrder->setChecked(appSettings.value(QLatin1String("ImportInDiskOrder"), false).toBool());
   m_fileDialog->restoreState(appSettings.value(QLatin1String("AddPhotosState")).toByteArray());
   const int setting_map = appSettings.value(QLatin1String("MapType"), 0).toInt();
   switch (setting_map)
@@ -105,7 +109,15 @@ Window::Window(QWidget *parent)
   QObject::connect(ui.pb_back, SIGNAL(clicked()), this, SLOT(backClicked()));
   QObject::connect(ui.pb_next, SIGNAL(clicked()), this, SLOT(nextClicked()));
 
-  // get context-menu events on the image list:
+  // tell which rows are shown once the list has come to rest:
+  m_visibleRowsTimer = new QTimer(this);
+  m_visibleRowsTimer->setSingleShot(true);
+  m_visibleRowsTimer->setInterval(100);
+  QObject::connect(m_visibleRowsTimer, SIGNAL(timeout()), this, SLOT(updateVisiblePhotos()));
+  QObject::connect(ui.lv_photos->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(visibleRowsChanged()));
+  QObject::connect(ui.lv_photos->horizontalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(visibleRowsChanged()));
+
+  // get context-menu and resize events on the image list:
   ui.lv_photos->installEventFilter(this);
   ui.lv_photos->setSelectionMode(QAbstractItemView::ExtendedSelection);
 }
@@ -129,7 +141,8 @@ void Window::selectFile()
 
 void Window::backClicked()
 {
-  const int rowCount = static_cast<QStandardItemModel*>(ui.lv_photos->model())->rowCount();
+  const QAbstractItemModel * const model = ui.lv_photos->model();
+  const int rowCount = model->rowCount();
 
   if (0 == rowCount)
   {
@@ -137,20 +150,21 @@ void Window::backClicked()
   }
 
   const int currentRow = ui.lv_photos->currentIndex().row();
-  QStandardItem *nextItem = static_cast<QStandardItemModel*>(ui.lv_photos->model())->item(currentRow-1);
+  QModelIndex nextIndex = model->index(currentRow-1, 0);
   
-  if (!nextItem)
+  if (!nextIndex.isValid())
   {
-    nextItem = static_cast<QStandardItemModel*>(ui.lv_photos->model())->item(rowCount-1);
+    nextIndex = model->index(rowCount-1, 0);
   }
   
-  ui.lv_photos->setCurrentIndex(nextItem->index());
-  photoClicked(nextItem->index());
+  ui.lv_photos->setCurrentIndex(nextIndex);
+  photoClicked(nextIndex);
 }
 
 void Window::nextClicked()
 {
-  const int rowCount = static_cast<QStandardItemModel*>(ui.lv_photos->model())->rowCount();
+  const QAbstractItemModel * const model = ui.lv_photos->model();
+  const int rowCount = model->rowCount();
 
   if (0 == rowCount)
   {
@@ -159,15 +173,15 @@ void Window::nextClicked()
 
   const int currentRow = ui.lv_photos->currentIndex().row();
   
-  QStandardItem *nextItem = static_cast<QStandardItemModel*>(ui.lv_photos->model())->item(currentRow+1);
+  QModelIndex nextIndex = model->index(currentRow+1, 0);
   
-  if (!nextItem)
+  if (!nextIndex.isValid())
   {
-    nextItem = static_cast<QStandardItemModel*>(ui.lv_photos->model())->item(0);
+    nextIndex = model->index(0, 0);
   }
   
-  ui.lv_photos->setCurrentIndex(nextItem->index());
-  photoClicked(nextItem->index());
+  ui.lv_photos->setCurrentIndex(nextIndex);
+  photoClicked(nextIndex);
 }
 
 void Window::filesSelected(const QStringList &selected)
@@ -181,17 +195,16 @@ void Window::filesSelected(const QStringList &selected)
 
 void Window::photoClicked(const QModelIndex &index)
 {
-  const QStandardItemModel * const model = static_cast<QStandardItemModel*>(ui.lv_photos->model());
-  const QStandardItem * const item = model->itemFromIndex(index);
-
-  const QVariant v = item->data(PhotoRole);
+  const QVariant v = index.data(PhotoRole);
   const Photo photo = v.value<Photo>();
   centerMapOn(&photo);
 }
 
 void Window::centerMapOn(const Photo * const photo)
 {
-  ui.l_photo->setPixmap(photo->getThumbnailPixmap());
+  m_previewPhoto = *photo;
+  emit(selectedPhotoChanged(photo->getFilename()));
+  ui.l_photo->setPixmap(photo->getThumbnailPixmap(ThumbnailStore::levelSize(ThumbnailStore::LargeLevel)));
   m_marble->centerOn(photo->getGpsLong(), photo->getGpsLat());
   if (ui.actionZoomOnSelectedPhoto->isChecked())
   {
@@ -199,6 +212,51 @@ void Window::centerMapOn(const Photo * const photo)
   }
 }
 
+// shows the preview once its thumbnail was created in the background, the list is updated by the model
+void Window::thumbnailCreated(const QString &filename)
+{
+  if (filename == m_previewPhoto.getFilename())
+  {
+    ui.l_photo->setPixmap(m_previewPhoto.getThumbnailPixmap(ThumbnailStore::levelSize(ThumbnailStore::LargeLevel)));
+  }
+}
+
+void Window::visibleRowsChanged()
+{
+  m_visibleRowsTimer->start();
+}
+
+// collects the file names of the rows which are shown, and of the page below them which is likely to be shown next
+void Window::updateVisiblePhotos()
+{
+  const QAbstractItemModel * const model = ui.lv_photos->model();
+  if (!model)
+    return;
+
+  const QRect area = ui.lv_photos->viewport()->rect();
+  const QModelIndex first = ui.lv_photos->indexAt(area.topLeft() + QPoint(1, 1));
+  const int rowCount = model->rowCount();
+
+  QStringList filenames;
+  int row = first.isValid() ? first.row() : 0;
+  for (; row < rowCount; ++row)
+  {
+    const QModelIndex index = model->index(row, 0);
+    if (!ui.lv_photos->visualRect(index).intersects(area))
+      break;
+
+    filenames << index.data(Qt::ToolTipRole).toString();
+  }
+
+  const int visibleRows = filenames.size();
+  for (int ahead = 0; (ahead < visibleRows) && (row < rowCount); ++ahead, ++row)
+  {
+    filenames << model->index(row, 0).data(Qt::ToolTipRole).toString();
+  }
+
+  emit(visiblePhotosChanged(filenames));
+}
+
 void Window::mapActionTriggered(QAction *action)
 {
   Q_UNUSED(action);
@@ -239,6 +297,7 @@ void Window::closeEvent(QCloseEvent *event)
 
   appSettings.setValue(QLatin1String("ZoomOnSelectedPhoto"), ui.actionZoomOnSelectedPhoto->isChecked());
   appSettings.setValue(QLatin1String("UseClustering"), ui.actionUseClustering->isChecked());
+  appSettings.setValue(QLatin1String("ImportInDiskOrder"), ui.actionImportInDiskOrder->isChecked());
 
   int projection_value = 0;
   if (ui.actionFlat->isChecked())
@@ -295,6 +354,10 @@ bool Window::eventFilter(QObject *object, QEvent* event)
   }
   else
   {
+    if ((object == ui.lv_photos) && (event->type() == QEvent::Resize))
+    {
+      visibleRowsChanged();
+    }
     return QObject::eventFilter(object, event);
   }
 }
@@ -311,32 +374,27 @@ void Window::on_actionRemovePhoto_triggered()
     if (selectedStuff.isEmpty())
       return; // nothing selected
 
-    QStandardItemModel * const stdmodel = static_cast<QStandardItemModel*>(ui.lv_photos->model());
-    if (!stdmodel)
+    PhotoModel * const model = static_cast<PhotoModel*>(ui.lv_photos->model());
+    if (!model)
     {
       qDebug()<<"model not found";
       return;
     }
 
-    // convert the model-indices to persistent model indices which will stay valid across deletion:
-    QList<QPersistentModelIndex> persistentIndices;
-    for (QModelIndexList::const_iterator it = selectedStuff.begin(); it!=selectedStuff.end(); ++it) {
-       persistentIndices << *it;
-    }
-
-    // TODO: this does not work for more than one item!
-    for (QList<QPersistentModelIndex>::const_iterator it = persistentIndices.begin(); it!=persistentIndices.end(); ++it)
+    // all rows go at once, so that the map is only reclustered once:
+    QList<int> rows;
+    for (QModelIndexList::const_iterator it = selectedStuff.begin(); it!=selectedStuff.end(); ++it)
     {
-      stdmodel->removeRow(it->row());
+      rows << it->row();
     }
+    model->removePhotos(rows);
 
     repaintMarbleWidget();
 }
 
 void Window::on_actionCopyCoordinates_triggered()
 {
-    const QStandardItemModel * const model = static_cast<QStandardItemModel*>(ui.lv_photos->model());
-    const QVariant v = model->itemFromIndex(ui.lv_photos->currentIndex())->data(PhotoRole);
+    const QVariant v = ui.lv_photos->currentIndex().data(PhotoRole);
     const Photo photo = v.value<Photo>();
 
     const qreal lat = photo.getGpsLat();
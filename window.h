@@ -21,7 +21,6 @@
 #define WINDOW_H
 
 #include <QtGui>
-#include <QStandardItemModel>
 
 #include <MarbleWidget.h>
 
@@ -49,6 +48,8 @@ class Window : public QMainWindow
     QFileDialog *m_fileDialog;
     QActionGroup *m_actionGroupMap;
     QActionGroup *m_actionGroupProjection;
+    Photo m_previewPhoto;
+    QTimer *m_visibleRowsTimer;
  
   private slots:
     void on_actionCopyCoordinates_triggered();
@@ -57,6 +58,7 @@ class Window : public QMainWindow
     void filesSelected(const QStringList &files);
     void photoClicked(const QModelIndex &index);
     void hideMapClutter();
+    void updateVisiblePhotos();
 
     //Buttons/Menu items
     void backClicked();
@@ -72,9 +74,13 @@ class Window : public QMainWindow
   public slots:
     bool eventFilter(QObject *object, QEvent* event);
     void on_actionUseClustering_triggered(bool checked);
+    void thumbnailCreated(const QString &filename);
+    void visibleRowsChanged();
 
   signals:  
     void selectedFiles(const QStringList &files);
+    void visiblePhotosChanged(const QStringList &filenames);
+    void selectedPhotoChanged(const QString &filename);
     
   private:
     Q_DISABLE_COPY(Window)